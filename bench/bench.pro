@@ -0,0 +1,7 @@
+# -------------------------------------------------
+# Benchmarks for Wique. Not part of the application build.
+# -------------------------------------------------
+TEMPLATE = subdirs
+SUBDIRS += \
+    refresh \
+    wikilinks
@@ -0,0 +1,176 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+// Runs Wique's refresh pipeline (DataCoordinator and everything below it)
+// against a synthetic wiki served from localhost, and reports how long a
+// cold sync and an incremental sync take.
+
+#include "mockwikiserver.h"
+#include "datacoordinator.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QNetworkAccessManager>
+#include <QSqlQuery>
+#include <QTemporaryDir>
+#include <QThread>
+
+#include <cstdio>
+
+static bool verbose = false;
+
+static void
+benchLog(QtMsgType type, const QMessageLogContext&, const QString& msg)
+{
+	// The pipeline's progress messages would drown out the results
+	if (type == QtDebugMsg && !verbose)
+		return;
+
+	std::fprintf(stderr, "%s\n", msg.toUtf8().constData());
+	if (type == QtFatalMsg)
+		abort();
+}
+
+struct RunResult
+{
+	bool success;
+	qint64 elapsedMs;
+	MockWikiServer::Stats server;
+	int storedPages;
+};
+
+static int
+countStoredPages()
+{
+	QSqlQuery q;
+	q.exec("SELECT COUNT(*) FROM Pages");
+	return q.next() ? q.value(0).toInt() : -1;
+}
+
+static RunResult
+runRefresh(DataCoordinator& dataCoordinator, MockWikiServer* server, bool fullCrawl)
+{
+	QMetaObject::invokeMethod(server, [=] { server->resetStats(); }, Qt::BlockingQueuedConnection);
+
+	RunResult result;
+	QEventLoop loop;
+	auto connection = QObject::connect(&dataCoordinator, &DataCoordinator::currentJobFinished, [&](bool success)
+	{
+		result.success = success;
+		loop.quit();
+	});
+
+	QElapsedTimer timer;
+	timer.start();
+	dataCoordinator.refreshDatabase(fullCrawl);
+	loop.exec();
+	result.elapsedMs = timer.elapsed();
+	QObject::disconnect(connection);
+
+	QMetaObject::invokeMethod(server, [&] { result.server = server->stats(); }, Qt::BlockingQueuedConnection);
+	result.storedPages = countStoredPages();
+	return result;
+}
+
+static void
+printResult(const char* name, const RunResult& result)
+{
+	double seconds = qMax<qint64>(result.elapsedMs, 1) / 1000.0;
+	std::printf("%-12s %-4s %9.2f %9lld %11.1f %11lld %11.1f %9d\n",
+			name,
+			result.success ? "ok" : "FAIL",
+			seconds,
+			static_cast<long long>(result.server.requests),
+			result.server.wireBytes / 1024.0,
+			static_cast<long long>(result.server.pagesServed),
+			result.server.pagesServed / seconds,
+			result.storedPages);
+}
+
+int
+main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Benchmarks a cold and an incremental refresh against a mock wiki.");
+	parser.addHelpOption();
+
+	QCommandLineOption pagesOption("pages", "Number of pages in the wiki.", "count", "5000");
+	QCommandLineOption sizeOption("page-size", "Median page size, in bytes.", "bytes", "3000");
+	QCommandLineOption spreadOption("size-spread", "Spread (log-normal sigma) of page sizes.", "sigma", "1.0");
+	QCommandLineOption redirectOption("redirects", "Fraction of pages that are redirects.", "ratio", "0.1");
+	QCommandLineOption latencyOption("latency", "Added to every reply.", "ms", "20");
+	QCommandLineOption editsOption("edits", "Fraction of pages edited before the incremental sync.", "ratio", "0.02");
+	QCommandLineOption concurrencyOption("concurrency", "Maximum number of requests in flight.", "count", "4");
+	QCommandLineOption verboseOption("verbose", "Show the pipeline's log.");
+	parser.addOptions({pagesOption, sizeOption, spreadOption, redirectOption, latencyOption,
+			editsOption, concurrencyOption, verboseOption});
+	parser.process(app);
+
+	verbose = parser.isSet(verboseOption);
+	qInstallMessageHandler(benchLog);
+
+	MockWikiConfig config;
+	config.pageCount = parser.value(pagesOption).toInt();
+	config.medianPageSize = parser.value(sizeOption).toInt();
+	config.pageSizeSpread = parser.value(spreadOption).toDouble();
+	config.redirectRatio = parser.value(redirectOption).toDouble();
+	config.latencyMs = parser.value(latencyOption).toInt();
+
+	// The server gets a thread of its own, so that serving doesn't count against the client
+	QThread serverThread;
+	auto server = new MockWikiServer(config);
+	server->moveToThread(&serverThread);
+	QObject::connect(&serverThread, &QThread::finished, server, &QObject::deleteLater);
+	serverThread.start();
+
+	quint16 port = 0;
+	QMetaObject::invokeMethod(server, [&] { port = server->start(); }, Qt::BlockingQueuedConnection);
+	if (port == 0)
+	{
+		std::fprintf(stderr, "Failed to start the mock server\n");
+		serverThread.quit();
+		serverThread.wait();
+		return 1;
+	}
+
+	// Database writes data.db into the current folder
+	QTemporaryDir workDir;
+	QDir::setCurrent(workDir.path());
+
+	int exitCode = 0;
+	{
+		QNetworkAccessManager netAccessManager;
+		DataCoordinator dataCoordinator;
+		dataCoordinator.setNetworkAccessManager(&netAccessManager);
+		dataCoordinator.setApiUrl(QUrl(QString("http://127.0.0.1:%1/api.php").arg(port)));
+		dataCoordinator.setMaxConcurrentRequests(parser.value(concurrencyOption).toInt());
+
+		std::printf("%d pages, median %d bytes, %.0f%% redirects, %d ms latency, %s requests in flight\n\n",
+				config.pageCount, config.medianPageSize, config.redirectRatio * 100, config.latencyMs,
+				parser.value(concurrencyOption).toUtf8().constData());
+		std::printf("%-12s %-4s %9s %9s %11s %11s %11s %9s\n",
+				"Sync", "", "Time (s)", "Requests", "Wire (KiB)", "Pages", "Pages/s", "Rows");
+
+		auto cold = runRefresh(dataCoordinator, server, true);
+		printResult("cold", cold);
+
+		double edits = parser.value(editsOption).toDouble();
+		QMetaObject::invokeMethod(server, [=] { server->editPages(edits); }, Qt::BlockingQueuedConnection);
+
+		auto incremental = runRefresh(dataCoordinator, server, false);
+		printResult("incremental", incremental);
+
+		if (!cold.success || !incremental.success)
+			exitCode = 1;
+	}
+
+	serverThread.quit();
+	serverThread.wait();
+	QDir::setCurrent(QDir::tempPath());
+	return exitCode;
+}
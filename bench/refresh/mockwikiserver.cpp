@@ -0,0 +1,454 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "mockwikiserver.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMap>
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrl>
+
+#include <zlib.h>
+#include <algorithm>
+#include <cmath>
+
+static const double pi = 3.14159265358979323846;
+
+// Non-bots get at most 500 list entries per request
+static const int listLimit = 500;
+
+static const QStringList vocabulary{
+	"Qt", "widget", "signal", "slot", "model", "view", "thread", "event", "loop",
+	"property", "layout", "build", "deploy", "QML", "item", "example", "the", "a",
+	"and", "of", "to", "in", "is", "for", "with", "on"
+};
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+MockWikiServer::MockWikiServer(const MockWikiConfig& config, QObject* parent) :
+	QTcpServer(parent),
+	config(config),
+	clock(QDateTime::currentDateTimeUtc().addDays(-7)),
+	rng(config.seed)
+{
+	resetStats();
+	generatePages();
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+quint16
+MockWikiServer::start()
+{
+	if (!listen(QHostAddress::LocalHost))
+		return 0;
+	return serverPort();
+}
+
+void
+MockWikiServer::editPages(double fraction)
+{
+	int editCount = qBound(0, qRound(pages.count() * fraction), pages.count());
+	QVector<int> order(pages.count());
+	for (int i = 0; i < order.count(); ++i)
+		order[i] = i;
+	for (int i = 0; i < editCount; ++i)
+	{
+		int j = i + static_cast<int>(rng.bounded(static_cast<quint32>(order.count() - i)));
+		std::swap(order[i], order[j]);
+
+		MockPage& page = pages[order[i]];
+		page.touched = nextTimestamp();
+		if (!page.content.startsWith("#REDIRECT"))
+			page.content += "\n" + generateText(64);
+		changes << MockChange{page.id, "edit", page.touched};
+	}
+}
+
+MockWikiServer::Stats
+MockWikiServer::stats() const
+{
+	return Stats{_requests.load(), _wireBytes.load(), _pagesServed.load()};
+}
+
+void
+MockWikiServer::resetStats()
+{
+	_requests.store(0);
+	_wireBytes.store(0);
+	_pagesServed.store(0);
+}
+
+/**********************************************************************\
+ * PROTECTED
+\**********************************************************************/
+void
+MockWikiServer::incomingConnection(qintptr socketDescriptor)
+{
+	auto socket = new QTcpSocket(this);
+	socket->setSocketDescriptor(socketDescriptor);
+	connect(socket, &QTcpSocket::readyRead, this, [=]
+	{
+		readRequests(socket);
+	});
+	connect(socket, &QTcpSocket::disconnected, this, [=]
+	{
+		buffers.remove(socket);
+		socket->deleteLater();
+	});
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+void
+MockWikiServer::generatePages()
+{
+	pages.reserve(config.pageCount);
+	for (int i = 0; i < config.pageCount; ++i)
+	{
+		MockPage page;
+		page.id = i + 1;
+		page.title = QString("Page %1").arg(page.id);
+		page.touched = nextTimestamp();
+		pages << page;
+		titleIds[page.title] = page.id;
+		changes << MockChange{page.id, "new", page.touched};
+	}
+
+	for (MockPage& page : pages)
+	{
+		if (rng.generateDouble() < config.redirectRatio)
+		{
+			int target = 1 + static_cast<int>(rng.bounded(static_cast<quint32>(pages.count())));
+			page.content = QString("#REDIRECT [[Page %1]]").arg(target);
+			continue;
+		}
+
+		// Log-normal sizes: most pages are small, a few are huge
+		double u1 = qMax(rng.generateDouble(), 1e-12);
+		double u2 = rng.generateDouble();
+		double z = std::sqrt(-2.0 * std::log(u1)) * std::cos(2 * pi * u2);
+		int size = static_cast<int>(config.medianPageSize * std::exp(config.pageSizeSpread * z));
+		page.content = generateText(qBound(16, size, 2 * 1024 * 1024));
+	}
+}
+
+QString
+MockWikiServer::generateText(int size)
+{
+	QString text;
+	text.reserve(size + 32);
+	while (text.size() < size)
+	{
+		quint32 roll = rng.bounded(100u);
+		if (roll < 3)
+			text += QString("[[Page %1]] ").arg(1 + rng.bounded(static_cast<quint32>(qMax(1, config.pageCount))));
+		else if (roll < 5)
+			text += "\n== Section ==\n";
+		else
+			text += vocabulary[static_cast<int>(rng.bounded(static_cast<quint32>(vocabulary.count())))] + ' ';
+	}
+	return text;
+}
+
+QString
+MockWikiServer::nextTimestamp()
+{
+	clock = clock.addSecs(1);
+	return clock.toString(Qt::ISODate);
+}
+
+void
+MockWikiServer::readRequests(QTcpSocket* socket)
+{
+	QByteArray& buffer = buffers[socket];
+	buffer += socket->readAll();
+
+	// Requests are GETs without bodies, so a blank line ends each one
+	int end;
+	while ((end = buffer.indexOf("\r\n\r\n")) != -1)
+	{
+		QByteArray head = buffer.left(end);
+		buffer.remove(0, end + 4);
+
+		QList<QByteArray> lines = head.split('\n');
+		QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+		bool acceptsGzip = false;
+		for (const QByteArray& line : lines)
+		{
+			if (line.toLower().startsWith("accept-encoding:") && line.contains("gzip"))
+				acceptsGzip = true;
+		}
+
+		QUrl url(QString::fromLatin1(requestLine.value(1)));
+		QByteArray body = QJsonDocument(answer(QUrlQuery(url))).toJson(QJsonDocument::Compact);
+		if (acceptsGzip)
+			body = gzip(body);
+
+		QByteArray reply = "HTTP/1.1 200 OK\r\n"
+				"Content-Type: application/json; charset=utf-8\r\n"
+				"Connection: keep-alive\r\n";
+		if (acceptsGzip)
+			reply += "Content-Encoding: gzip\r\n";
+		reply += "Content-Length: " + QByteArray::number(body.size()) + "\r\n\r\n";
+		reply += body;
+
+		++_requests;
+		QTimer::singleShot(config.latencyMs, socket, [=]
+		{
+			_wireBytes += reply.size();
+			socket->write(reply);
+		});
+	}
+}
+
+QJsonObject
+MockWikiServer::answer(const QUrlQuery& query)
+{
+	if (query.queryItemValue("meta") == "siteinfo")
+		return answerSiteInfo();
+	if (query.queryItemValue("generator") == "allpages")
+		return answerPageList(query);
+	if (query.queryItemValue("list") == "recentchanges")
+		return query.hasQueryItem("rcstart") ? answerRecentChanges(query) : answerLatestChange();
+	if (query.queryItemValue("prop").contains("revisions"))
+		return answerPageTexts(query);
+	if (query.hasQueryItem("titles"))
+		return answerTitleLookup(query);
+
+	QJsonObject error;
+	error["code"] = "unknown_action";
+	error["info"] = "Not supported by the mock server";
+	QJsonObject outerObj;
+	outerObj["error"] = error;
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerSiteInfo()
+{
+	// The usual namespaces. Only the main namespace has pages.
+	static const QMap<int, QString> namespaceNames{
+		{-2, "Media"}, {-1, "Special"}, {0, ""}, {1, "Talk"}, {2, "User"}, {3, "User talk"},
+		{4, "Project"}, {5, "Project talk"}, {6, "File"}, {7, "File talk"},
+		{8, "MediaWiki"}, {9, "MediaWiki talk"}, {10, "Template"}, {11, "Template talk"},
+		{12, "Help"}, {13, "Help talk"}, {14, "Category"}, {15, "Category talk"}};
+
+	QJsonObject namespacesObj;
+	for (auto it = namespaceNames.constBegin(); it != namespaceNames.constEnd(); ++it)
+	{
+		QJsonObject namespaceObj;
+		namespaceObj["id"] = it.key();
+		namespaceObj["case"] = "first-letter";
+		namespaceObj["*"] = it.value();
+		if (it.key() == 0)
+			namespaceObj["content"] = "";
+		namespacesObj[QString::number(it.key())] = namespaceObj;
+	}
+
+	QJsonObject queryObj;
+	queryObj["namespaces"] = namespacesObj;
+	QJsonObject outerObj;
+	outerObj["batchcomplete"] = "";
+	outerObj["query"] = queryObj;
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerLatestChange()
+{
+	QJsonArray changeArray;
+	if (!changes.isEmpty())
+	{
+		QJsonObject changeObj;
+		changeObj["timestamp"] = changes.last().timestamp;
+		changeArray << changeObj;
+	}
+
+	QJsonObject queryObj;
+	queryObj["recentchanges"] = changeArray;
+	QJsonObject outerObj;
+	outerObj["batchcomplete"] = "";
+	outerObj["query"] = queryObj;
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerRecentChanges(const QUrlQuery& query)
+{
+	// rcdir=newer: oldest first, starting at rcstart (inclusive)
+	QString since = query.queryItemValue("rcstart", QUrl::FullyDecoded);
+	int begin = query.hasQueryItem("rccontinue")
+			? query.queryItemValue("rccontinue").toInt()
+			: static_cast<int>(std::lower_bound(changes.constBegin(), changes.constEnd(), since,
+					[](const MockChange& change, const QString& timestamp) { return change.timestamp < timestamp; })
+					- changes.constBegin());
+	int end = qMin(begin + listLimit, changes.count());
+
+	QJsonArray changeArray;
+	for (int i = begin; i < end; ++i)
+	{
+		const MockPage& page = pages[changes[i].pageId - 1];
+		QJsonObject changeObj;
+		changeObj["type"] = changes[i].type;
+		changeObj["ns"] = 0;
+		changeObj["title"] = page.title;
+		changeObj["pageid"] = page.id;
+		changeObj["timestamp"] = changes[i].timestamp;
+		changeArray << changeObj;
+	}
+
+	QJsonObject queryObj;
+	queryObj["recentchanges"] = changeArray;
+	QJsonObject outerObj;
+	outerObj["query"] = queryObj;
+	if (end < changes.count())
+	{
+		QJsonObject contObj;
+		contObj["rccontinue"] = QString::number(end);
+		contObj["continue"] = "-||";
+		outerObj["continue"] = contObj;
+	}
+	else
+		outerObj["batchcomplete"] = "";
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerPageList(const QUrlQuery& query)
+{
+	// All pages are in the main namespace
+	QJsonObject outerObj;
+	outerObj["batchcomplete"] = "";
+	if (query.queryItemValue("gapnamespace") != "0")
+		return outerObj;
+
+	int begin = query.queryItemValue("gapcontinue").toInt();
+	int end = qMin(begin + qBound(1, query.queryItemValue("gaplimit").toInt(), listLimit), pages.count());
+
+	QJsonObject pagesObj;
+	for (int i = begin; i < end; ++i)
+	{
+		QJsonObject pageObj;
+		pageObj["pageid"] = pages[i].id;
+		pageObj["ns"] = 0;
+		pageObj["title"] = pages[i].title;
+		pageObj["touched"] = pages[i].touched;
+		pageObj["length"] = pages[i].content.size();
+		pagesObj[QString::number(pages[i].id)] = pageObj;
+	}
+
+	QJsonObject queryObj;
+	queryObj["pages"] = pagesObj;
+	outerObj["query"] = queryObj;
+	if (end < pages.count())
+	{
+		QJsonObject contObj;
+		contObj["gapcontinue"] = QString::number(end);
+		contObj["continue"] = "gapcontinue||";
+		outerObj["continue"] = contObj;
+		outerObj.remove("batchcomplete");
+	}
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerPageTexts(const QUrlQuery& query)
+{
+	QJsonObject pagesObj;
+	for (const QString& idString : query.queryItemValue("pageids").split('|'))
+	{
+		int id = idString.toInt();
+		if (id < 1 || id > pages.count())
+		{
+			QJsonObject missingObj;
+			missingObj["pageid"] = id;
+			missingObj["missing"] = "";
+			pagesObj[idString] = missingObj;
+			continue;
+		}
+
+		const MockPage& page = pages[id - 1];
+		QJsonObject revisionObj;
+		revisionObj["contentformat"] = "text/x-wiki";
+		revisionObj["contentmodel"] = "wikitext";
+		revisionObj["*"] = page.content;
+
+		QJsonObject pageObj;
+		pageObj["pageid"] = page.id;
+		pageObj["ns"] = 0;
+		pageObj["title"] = page.title;
+		pageObj["touched"] = page.touched;
+		pageObj["revisions"] = QJsonArray{revisionObj};
+		pagesObj[idString] = pageObj;
+		++_pagesServed;
+	}
+
+	QJsonObject queryObj;
+	queryObj["pages"] = pagesObj;
+	QJsonObject outerObj;
+	outerObj["batchcomplete"] = "";
+	outerObj["query"] = queryObj;
+	return outerObj;
+}
+
+QJsonObject
+MockWikiServer::answerTitleLookup(const QUrlQuery& query)
+{
+	QJsonObject pagesObj;
+	int missingIdx = -1;
+	for (const QString& title : query.queryItemValue("titles", QUrl::FullyDecoded).split('|'))
+	{
+		QJsonObject pageObj;
+		pageObj["ns"] = 0;
+		pageObj["title"] = title;
+
+		int id = titleIds.value(title, -1);
+		if (id == -1)
+		{
+			pageObj["missing"] = "";
+			pagesObj[QString::number(missingIdx--)] = pageObj;
+		}
+		else
+		{
+			pageObj["pageid"] = id;
+			pageObj["touched"] = pages[id - 1].touched;
+			pagesObj[QString::number(id)] = pageObj;
+		}
+	}
+
+	QJsonObject queryObj;
+	queryObj["pages"] = pagesObj;
+	QJsonObject outerObj;
+	outerObj["batchcomplete"] = "";
+	outerObj["query"] = queryObj;
+	return outerObj;
+}
+
+QByteArray
+MockWikiServer::gzip(const QByteArray& data)
+{
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+
+	// 16 = gzip wrapper instead of zlib
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return data;
+
+	QByteArray output(static_cast<int>(deflateBound(&stream, static_cast<uLong>(data.size()))), Qt::Uninitialized);
+	stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.constData()));
+	stream.avail_in = static_cast<uInt>(data.size());
+	stream.next_out = reinterpret_cast<Bytef*>(output.data());
+	stream.avail_out = static_cast<uInt>(output.size());
+	deflate(&stream, Z_FINISH);
+	output.resize(static_cast<int>(stream.total_out));
+	deflateEnd(&stream);
+	return output;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef MOCKWIKISERVER_H
+#define MOCKWIKISERVER_H
+
+#include <QTcpServer>
+#include <QAtomicInteger>
+#include <QDateTime>
+#include <QHash>
+#include <QJsonObject>
+#include <QRandomGenerator>
+#include <QUrlQuery>
+#include <QVector>
+
+class QTcpSocket;
+
+// Shape of the synthetic wiki
+struct MockWikiConfig
+{
+	int pageCount = 5000;
+	int medianPageSize = 3000; // Bytes of wikitext
+	double pageSizeSpread = 1.0; // Sigma of the log-normal size distribution
+	double redirectRatio = 0.1;
+	int latencyMs = 20;         // Added to every reply
+	quint32 seed = 1;
+};
+
+// Stands in for api.php, speaking just enough HTTP/1.1 (keep-alive, gzip)
+// and just enough of the MediaWiki API for Wique's refresh.
+//
+// Lives in its own thread, so that serving doesn't eat into the client's time.
+// Use start()/editPages() through QMetaObject::invokeMethod().
+class MockWikiServer : public QTcpServer
+{
+	Q_OBJECT
+
+public:
+	explicit MockWikiServer(const MockWikiConfig& config, QObject* parent = nullptr);
+
+	// Returns the port, or 0 on failure
+	quint16 start();
+
+	// Gives a fraction of the pages a new revision, and lists them in the recent changes
+	void editPages(double fraction);
+
+	struct Stats
+	{
+		qint64 requests;
+		qint64 wireBytes;
+		qint64 pagesServed; // Page texts sent
+	};
+	Stats stats() const;
+	void resetStats();
+
+protected:
+	void incomingConnection(qintptr socketDescriptor) override;
+
+private:
+	struct MockPage
+	{
+		int id;
+		QString title;
+		QString touched;
+		QString content;
+	};
+	struct MockChange
+	{
+		int pageId;
+		QString type;
+		QString timestamp;
+	};
+
+	void generatePages();
+	QString generateText(int size);
+	QString nextTimestamp();
+
+	void readRequests(QTcpSocket* socket);
+	QJsonObject answer(const QUrlQuery& query);
+	QJsonObject answerSiteInfo();
+	QJsonObject answerLatestChange();
+	QJsonObject answerRecentChanges(const QUrlQuery& query);
+	QJsonObject answerPageList(const QUrlQuery& query);
+	QJsonObject answerPageTexts(const QUrlQuery& query);
+	QJsonObject answerTitleLookup(const QUrlQuery& query);
+
+	static QByteArray gzip(const QByteArray& data);
+
+	MockWikiConfig config;
+	QVector<MockPage> pages; // Index = ID - 1
+	QHash<QString, int> titleIds;
+	QVector<MockChange> changes; // Oldest first
+	QDateTime clock;
+	QRandomGenerator rng;
+
+	QHash<QTcpSocket*, QByteArray> buffers;
+
+	QAtomicInteger<qint64> _requests;
+	QAtomicInteger<qint64> _wireBytes;
+	QAtomicInteger<qint64> _pagesServed;
+};
+
+#endif // MOCKWIKISERVER_H
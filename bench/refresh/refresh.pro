@@ -0,0 +1,42 @@
+# -------------------------------------------------
+# End-to-end refresh benchmark against a mock api.php
+# -------------------------------------------------
+QT += network sql concurrent
+QT -= gui
+CONFIG += C++11 console
+CONFIG -= app_bundle
+TARGET = refreshbench
+TEMPLATE = app
+
+# zlib decodes (and the mock server encodes) gzip'ed replies. Qt ships its own copy on Windows.
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += main.cpp \
+    mockwikiserver.cpp \
+    $$WIQUE_SRC/database.cpp \
+    $$WIQUE_SRC/datacoordinator.cpp \
+    $$WIQUE_SRC/jsonstreamreader.cpp \
+    $$WIQUE_SRC/pagetablemodel.cpp \
+    $$WIQUE_SRC/redirectgraph.cpp \
+    $$WIQUE_SRC/syncmetrics.cpp \
+    $$WIQUE_SRC/wikilinks.cpp \
+    $$WIQUE_SRC/wikiquerier.cpp \
+    $$WIQUE_SRC/wikitransport.cpp
+HEADERS += \
+    mockwikiserver.h \
+    $$WIQUE_SRC/database.h \
+    $$WIQUE_SRC/datacoordinator.h \
+    $$WIQUE_SRC/jsonstreamreader.h \
+    $$WIQUE_SRC/pagetablemodel.h \
+    $$WIQUE_SRC/queryresults.h \
+    $$WIQUE_SRC/redirectgraph.h \
+    $$WIQUE_SRC/syncmetrics.h \
+    $$WIQUE_SRC/wikilinks.h \
+    $$WIQUE_SRC/wikipage.h \
+    $$WIQUE_SRC/wikiquerier.h \
+    $$WIQUE_SRC/wikisite.h \
+    $$WIQUE_SRC/wikitransport.h
@@ -0,0 +1,214 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+// Times WikiLinks against the QRegularExpression code that it replaced, over
+// every page of a Wique database (or over a synthetic corpus), on one thread.
+
+#include "wikilinks.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QRegularExpression>
+#include <QSet>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <cstdio>
+#include <functional>
+
+// The old Database::extractRedirection(), as it was
+static QString
+regexRedirectTarget(const QString& wikiText)
+{
+	if (!wikiText.startsWith("#REDIRECT"))
+		return "";
+
+	QRegularExpression regex_wikiLink("\\[\\[(.*?)\\]\\]");
+	auto match = regex_wikiLink.match(wikiText);
+	if (!match.hasMatch())
+		return "";
+
+	QString link = match.captured(1);
+	link.replace("_", " ");
+	if (link.startsWith(":Category"))
+		link = link.mid(1);
+	return link;
+}
+
+// The old Database::extractLinks(), as it was
+static QStringList
+regexLinks(const QString& wikiText)
+{
+	static const QRegularExpression regex_wikiLink("\\[\\[([^\\[\\]|#]*)[^\\[\\]]*\\]\\]");
+
+	QStringList links;
+	QSet<QString> seen;
+	auto it = regex_wikiLink.globalMatch(wikiText);
+	while (it.hasNext())
+	{
+		QString link = it.next().captured(1).trimmed();
+		link.replace("_", " ");
+		if (link.startsWith("Category:"))
+			continue;
+		if (link.startsWith(':'))
+			link = link.mid(1);
+		if (link.isEmpty() || seen.contains(link))
+			continue;
+		seen.insert(link);
+		links << link;
+	}
+	return links;
+}
+
+static QVector<QString>
+loadCorpus(const QString& dbPath)
+{
+	QVector<QString> texts;
+	{
+		auto db = QSqlDatabase::addDatabase("QSQLITE", "corpus");
+		db.setDatabaseName(dbPath);
+		if (!db.open())
+		{
+			std::fprintf(stderr, "Cannot open %s\n", dbPath.toUtf8().constData());
+			return texts;
+		}
+		QSqlQuery q(db);
+		q.setForwardOnly(true);
+		if (!q.exec("SELECT wikitext FROM Content"))
+			std::fprintf(stderr, "Cannot read pages: %s\n", q.lastError().text().toUtf8().constData());
+		while (q.next())
+			texts << QString::fromUtf8(qUncompress(q.value(0).toByteArray()));
+	}
+	QSqlDatabase::removeDatabase("corpus");
+	return texts;
+}
+
+static QVector<QString>
+generateCorpus(int pageCount, int pageSize, double redirectRatio)
+{
+	static const QStringList words{"the", "Qt", "widget", "signal", "slot", "model", "view", "thread",
+			"build", "deploy", "QML", "property", "event", "loop", "plugin", "== Section ==\n"};
+	static const QStringList linkForms{"[[Page %1]]", "[[page_%1|label]]", "[[Page %1#Usage]]",
+			"[[:Category:Topic %1]]", "[[Category:Topic %1]]", "[[File:Shot %1.png|thumb|A [[Page %1]] shot]]",
+			"{{Template %1}}", "[http://example.com/%1 external]"};
+
+	QRandomGenerator rng(42);
+	QVector<QString> texts;
+	for (int i = 0; i < pageCount; ++i)
+	{
+		if (rng.generateDouble() < redirectRatio)
+		{
+			texts << QString("#REDIRECT [[Page %1]]").arg(rng.bounded(pageCount));
+			continue;
+		}
+
+		QString text;
+		while (text.size() < pageSize)
+		{
+			if (rng.bounded(100u) < 8)
+				text += linkForms[rng.bounded(linkForms.count())].arg(rng.bounded(pageCount)) + ' ';
+			else
+				text += words[rng.bounded(words.count())] + ' ';
+		}
+		texts << text;
+	}
+	return texts;
+}
+
+struct RunResult
+{
+	qint64 bestMs;
+	int redirects;
+	qint64 links;
+};
+
+static RunResult
+run(const QVector<QString>& texts, int repeat,
+		const std::function<QString(const QString&)>& redirectTarget,
+		const std::function<QStringList(const QString&)>& links)
+{
+	RunResult result{-1, 0, 0};
+	for (int r = 0; r < repeat; ++r)
+	{
+		QElapsedTimer timer;
+		timer.start();
+		int redirects = 0;
+		qint64 linkCount = 0;
+		for (const QString& text : texts)
+		{
+			if (!redirectTarget(text).isEmpty())
+				++redirects;
+			linkCount += links(text).count();
+		}
+		qint64 ms = timer.elapsed();
+
+		if (result.bestMs == -1 || ms < result.bestMs)
+			result.bestMs = ms;
+		result.redirects = redirects;
+		result.links = linkCount;
+	}
+	return result;
+}
+
+static void
+printResult(const char* name, const RunResult& result, qint64 totalChars)
+{
+	double seconds = qMax<qint64>(result.bestMs, 1) / 1000.0;
+	std::printf("%-8s %10lld %12.1f %10d %12lld\n",
+			name,
+			static_cast<long long>(result.bestMs),
+			totalChars / seconds / 1e6,
+			result.redirects,
+			static_cast<long long>(result.links));
+}
+
+int
+main(int argc, char* argv[])
+{
+	QCoreApplication app(argc, argv);
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Compares the wikilink scanner with the regex it replaced.");
+	parser.addHelpOption();
+
+	QCommandLineOption dbOption("db", "Wique database to take the pages from, instead of a synthetic corpus.", "file");
+	QCommandLineOption pagesOption("pages", "Number of synthetic pages.", "count", "20000");
+	QCommandLineOption sizeOption("page-size", "Size of each synthetic page, in characters.", "chars", "3000");
+	QCommandLineOption redirectOption("redirects", "Fraction of synthetic pages that are redirects.", "ratio", "0.1");
+	QCommandLineOption repeatOption("repeat", "Runs per extractor. The fastest one counts.", "count", "3");
+	parser.addOptions({dbOption, pagesOption, sizeOption, redirectOption, repeatOption});
+	parser.process(app);
+
+	QVector<QString> texts = parser.isSet(dbOption)
+			? loadCorpus(parser.value(dbOption))
+			: generateCorpus(parser.value(pagesOption).toInt(), parser.value(sizeOption).toInt(),
+					parser.value(redirectOption).toDouble());
+	if (texts.isEmpty())
+	{
+		std::fprintf(stderr, "No pages to scan\n");
+		return 1;
+	}
+
+	qint64 totalChars = 0;
+	for (const QString& text : texts)
+		totalChars += text.size();
+	std::printf("%d pages, %.1f M characters\n\n", texts.count(), totalChars / 1e6);
+
+	int repeat = qMax(1, parser.value(repeatOption).toInt());
+	auto regex = run(texts, repeat, &regexRedirectTarget, &regexLinks);
+	WikiLinks wikiLinks;
+	auto scanner = run(texts, repeat,
+			[&](const QString& text) { return wikiLinks.redirectTarget(text); },
+			[&](const QString& text) { return wikiLinks.links(text); });
+
+	// The counts differ a little: the scanner also recognizes lower-case and
+	// translated redirects, and normalizes first letters (so fewer duplicates)
+	std::printf("%-8s %10s %12s %10s %12s\n", "", "Best (ms)", "M chars/s", "Redirects", "Links");
+	printResult("regex", regex, totalChars);
+	printResult("scanner", scanner, totalChars);
+	std::printf("\nSpeed-up: %.1fx\n", qMax<qint64>(regex.bestMs, 1) / double(qMax<qint64>(scanner.bestMs, 1)));
+	return 0;
+}
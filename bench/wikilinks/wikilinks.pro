@@ -0,0 +1,17 @@
+# -------------------------------------------------
+# Microbenchmark of the wikilink scanner against the regex it replaced
+# -------------------------------------------------
+QT += sql
+QT -= gui
+CONFIG += C++11 console
+CONFIG -= app_bundle
+TARGET = wikilinksbench
+TEMPLATE = app
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += main.cpp \
+    $$WIQUE_SRC/wikilinks.cpp
+HEADERS += \
+    $$WIQUE_SRC/wikilinks.h
@@ -2,49 +2,212 @@
 // This code is licensed under the MIT license (see LICENSE.MIT for details)
 
 #include "database.h"
+#include "wikilinks.h"
 
-#include <QApplication>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QJsonDocument>
 #include <QJsonObject>
+#include <QSaveFile>
+#include <QSet>
 #include <QRegularExpression>
 #include <QSqlError>
 #include <QSqlQuery>
-#include <QSqlQueryModel>
+#include <QtConcurrent>
+
+#include <memory>
 
 #include <QDebug>
 
+static const QString scanConnectionName = "RedirectScan";
+static const QString exportConnectionName = "Export";
+
+// Where the page listing of an interrupted refresh left off
+static const QString listingResumeKey = "listingResumePoint";
+
+// Lives in the export folder, next to the exported files
+static const QString exportManifestName = "wique-manifest.json";
+
+// Number of pages whose text is held in memory at once during an export
+static const int exportBlockSize = 256;
+
+// Number of pages whose text is held in memory at once during a scan
+static const int scanBlockSize = 512;
+
+// The wikitext lives in its own table, so that metadata queries don't have to wade through it
+static const QString createPageTable =
+		"CREATE TABLE IF NOT EXISTS %1("
+		"id INTEGER PRIMARY KEY,"
+
+		// BUG? Must write "Pages(id)" instead of "id", or else Qt's SQLite driver will fail to prepare queries
+		"redirection INTEGER REFERENCES Pages(id),"
+		"title TEXT,"
+		"timestamp TEXT,"
+
+		// Derived from redirectTarget by the RedirectGraph. redirection is the first hop.
+		"redirectTarget TEXT,"
+		"finalTarget INTEGER,"
+		"redirectStatus TEXT)";
+
+// Contentless full-text index (rowid = page ID). The text itself is only stored once, in Content.
+static const QString createSearchTable =
+		"CREATE VIRTUAL TABLE SearchIndex USING fts5(title, wikitext, content='')";
+
+// Matches in titles count for more than matches in the text
+static const QString searchRanking = "bm25(SearchIndex, 10.0, 1.0)";
+
+// Characters of context on either side of a search match
+static const int snippetRadius = 60;
+
+// The wikitext is stored as qCompress()'ed UTF-8
+static const QString createContentTable =
+		"CREATE TABLE IF NOT EXISTS Content("
+		"id INTEGER PRIMARY KEY REFERENCES Pages(id) ON DELETE CASCADE,"
+		"wikitext BLOB)";
+
+// Every wikilink in every page. to_id is NULL while the linked page doesn't exist.
+static const QString createLinkTable =
+		"CREATE TABLE IF NOT EXISTS Links("
+		"from_id INTEGER REFERENCES Pages(id) ON DELETE CASCADE,"
+		"to_title TEXT,"
+		"to_id INTEGER REFERENCES Pages(id) ON DELETE SET NULL)";
+
+// The timestamp of each page whose links are in the Links table
+static const QString createLinkStateTable =
+		"CREATE TABLE IF NOT EXISTS LinksExtracted("
+		"id INTEGER PRIMARY KEY REFERENCES Pages(id) ON DELETE CASCADE,"
+		"timestamp TEXT)";
+
+// Bump whenever WikiLinks changes, so that the next scan (which the next refresh
+// runs, see extractionIsOutdated()) extracts all redirect targets and links again
+static const QString linkExtractorVersionKey = "linkExtractorVersion";
+static const QString linkExtractorVersion = "2";
+
+// What WikiLinks was built from (see setSiteInfo())
+static const QString siteInfoKey = "siteInfo";
+
+// For QtConcurrent, which needs the result type spelled out
+struct RedirectExtractor
+{
+	typedef QString result_type;
+	const WikiLinks* wikiLinks;
+
+	QString operator()(const QByteArray& compressedText) const
+	{ return wikiLinks->redirectTarget(QString::fromUtf8(qUncompress(compressedText))); }
+};
+
+struct LinkExtractor
+{
+	typedef QStringList result_type;
+	const WikiLinks* wikiLinks;
+
+	QStringList operator()(const QString& wikiText) const
+	{ return wikiLinks->links(wikiText); }
+	QStringList operator()(const QByteArray& compressedText) const
+	{ return wikiLinks->links(QString::fromUtf8(qUncompress(compressedText))); }
+};
+
 /**********************************************************************\
  * CONSTRUCTOR/DESTRUCTOR
 \**********************************************************************/
-Database::Database(QObject* parent) :
+Database::Database(const QString& filePath, const QString& connectionName, QObject* parent) :
 	QObject(parent),
-	_db(QSqlDatabase::addDatabase("QSQLITE")),
-	_model(new QSqlQueryModel(this))
+	_db(QSqlDatabase::addDatabase("QSQLITE",
+			connectionName.isEmpty() ? QString(QSqlDatabase::defaultConnection) : connectionName)),
+	_model(new PageTableModel(_db, this)),
+	_metrics(nullptr),
+	_redirectGraphLoaded(false),
+	_searchAvailable(false)
 {
-	_db.setDatabaseName("data.db");
+	_db.setDatabaseName(filePath);
 	if (!_db.open())
 	{
-		qWarning() << "ERROR: Database: Failed to open data.db";
+		qWarning() << "ERROR: Database: Failed to open" << filePath;
 		return;
 	}
 
-	QString createPageTable =
-			"CREATE TABLE IF NOT EXISTS Pages("
-			"id INTEGER PRIMARY KEY,"
-
-			// BUG? Must write "Pages(id)" instead of "id", or else Qt's SQLite driver will fail to prepare queries
-			"redirection INTEGER REFERENCES Pages(id),"
-			"title TEXT,"
-			"timestamp TEXT,"
-			"wikitext TEXT)";
+	// Older databases kept the text inline. Must be done before foreign keys are enforced.
+	moveTextOutOfPages();
 
-	QSqlQuery q;
+	QSqlQuery q(_db);
 	if (!q.exec("PRAGMA foreign_keys = ON"))
 		qWarning() << "ERROR: Database: Enabling foreign keys:" << q.lastError();
-	if (!q.exec(createPageTable))
+	if (!q.exec(createPageTable.arg("Pages")))
 		qWarning() << "ERROR: Database: Creating table Pages:" << q.lastError();
+	if (!q.exec(createContentTable))
+		qWarning() << "ERROR: Database: Creating table Content:" << q.lastError();
+	if (!q.exec("CREATE TABLE IF NOT EXISTS SyncState(key TEXT PRIMARY KEY, value TEXT)"))
+		qWarning() << "ERROR: Database: Creating table SyncState:" << q.lastError();
+
+	// Until the wiki has been asked, WikiLinks falls back to the most common syntax
+	QString siteInfo = syncState(siteInfoKey);
+	if (!siteInfo.isEmpty())
+		_wikiLinks = WikiLinks::fromSiteInfo(QJsonDocument::fromJson(siteInfo.toUtf8()).object());
+	if (!q.exec("CREATE TABLE IF NOT EXISTS ListedPages(id INTEGER PRIMARY KEY)"))
+		qWarning() << "ERROR: Database: Creating table ListedPages:" << q.lastError();
+	if (!q.exec("CREATE TABLE IF NOT EXISTS PendingPages(id INTEGER PRIMARY KEY)"))
+		qWarning() << "ERROR: Database: Creating table PendingPages:" << q.lastError();
+	if (!q.exec("CREATE INDEX IF NOT EXISTS Pages_title ON Pages(title)"))
+		qWarning() << "ERROR: Database: Creating title index:" << q.lastError();
+
+	if (!q.exec(createLinkTable))
+		qWarning() << "ERROR: Database: Creating table Links:" << q.lastError();
+	if (!q.exec(createLinkStateTable))
+		qWarning() << "ERROR: Database: Creating table LinksExtracted:" << q.lastError();
+	if (!q.exec("CREATE INDEX IF NOT EXISTS Links_from ON Links(from_id)")
+			|| !q.exec("CREATE INDEX IF NOT EXISTS Links_to_title ON Links(to_title)")
+			|| !q.exec("CREATE INDEX IF NOT EXISTS Links_to_id ON Links(to_id)"))
+	{
+		qWarning() << "ERROR: Database: Creating link indices:" << q.lastError();
+	}
+
+	// Nothing has been extracted into a new database yet, so nothing is out of date
+	if (!hasPages() && syncState(linkExtractorVersionKey).isEmpty())
+		setSyncState(linkExtractorVersionKey, linkExtractorVersion);
 
-	updateModel();
+	// Older databases only stored the first hop of each redirect
+	addRedirectColumns();
+	if (!q.exec("CREATE INDEX IF NOT EXISTS Pages_redirectStatus ON Pages(redirectStatus)"))
+		qWarning() << "ERROR: Database: Creating redirect status index:" << q.lastError();
+
+	// NOTE: "INSERT OR REPLACE" would delete the old row first, which trips the
+	//       foreign key of every page that redirects to it. Upsert needs SQLite 3.24+.
+	//       The derived redirect columns are filled in afterwards (see storeResolutions()).
+	_upsertQuery = QSqlQuery(_db);
+	if (!_upsertQuery.prepare(
+			"INSERT INTO Pages (id, title, timestamp, redirectTarget) "
+			"VALUES(:id, :title, :timestamp, :redirectTarget) "
+			"ON CONFLICT(id) DO UPDATE SET "
+			"title=excluded.title, timestamp=excluded.timestamp, redirectTarget=excluded.redirectTarget"))
+	{
+		qWarning() << "ERROR: Database: Preparing upsert query:" << _upsertQuery.lastError();
+	}
+
+	// Nothing refers to Content, so it's safe to replace whole rows
+	_contentQuery = QSqlQuery(_db);
+	if (!_contentQuery.prepare("INSERT OR REPLACE INTO Content (id, wikitext) VALUES(:id, :wikitext)"))
+		qWarning() << "ERROR: Database: Preparing content query:" << _contentQuery.lastError();
+
+	createSearchIndex();
+
+	_model->reload();
+}
+
+Database::~Database()
+{
+	// Workers hold their own connections, but they still call back into this object
+	_scanJob.waitForFinished();
+	_exportJob.waitForFinished();
+
+	// Every handle to the connection must be gone before it can be removed
+	delete _model;
+	_upsertQuery = QSqlQuery();
+	_contentQuery = QSqlQuery();
+	QString connectionName = _db.connectionName();
+	_db.close();
+	_db = QSqlDatabase();
+	QSqlDatabase::removeDatabase(connectionName);
 }
 
 
@@ -67,7 +230,7 @@ Database::allPageIds() const
 int
 Database::idOf(const QString& title) const
 {
-	QSqlQuery q;
+	QSqlQuery q(_db);
 	q.prepare("SELECT id FROM Pages WHERE title=:title");
 	q.bindValue(":title", title);
 	q.exec();
@@ -82,7 +245,7 @@ Database::lastModified(int pageId) const
 {
 	// NOTE: Storing QDateTime in QSQLITE is lossy :( Use QString instead
 
-	QSqlQuery q;
+	QSqlQuery q(_db);
 	if (!q.prepare("SELECT timestamp FROM Pages WHERE id=:id"))
 		qWarning() << "ERROR: Database: Binding timestamp query:" << q.lastError();
 	q.bindValue(":id", pageId);
@@ -93,194 +256,1257 @@ Database::lastModified(int pageId) const
 	return "";
 }
 
+QHash<int, QString>
+Database::allTimestamps() const
+{
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT id, timestamp FROM Pages"))
+		qWarning() << "ERROR: Database: Loading all timestamps:" << q.lastError();
+
+	QHash<int, QString> timestamps;
+	while (q.next())
+		timestamps.insert(q.value(0).toInt(), q.value(1).toString());
+	return timestamps;
+}
+
 void
-Database::exportWikiText(const QString& exportDir) const
+Database::exportWikiText(const QString& exportDir)
 {
+	if (_exportJob.isRunning())
+	{
+		qDebug() << "ERROR: Database: An export is already running.";
+		emit exportFinished(false);
+		return;
+	}
+
 	QDir dir(exportDir);
 	dir.mkdir("exports");
 	dir.cd("exports");
-	dir.absolutePath();
 
-	QSqlQuery q(_db);
-	if (!q.exec("SELECT title, wikitext FROM Pages"))
-		qWarning() << "ERROR: Database: Loading all text:" << q.lastError();
+	qDebug() << "== Exporting to" << dir.absolutePath() << "==";
 
-	while (q.next())
+	auto watcher = new QFutureWatcher<bool>(this);
+	connect(watcher, &QFutureWatcher<bool>::finished, [=]
 	{
-		QString title = q.value("title").toString();
-		title.replace('/', "__");
-		title.replace(':', "__"); // TODO: (Wiki) Fix weird Categories
+		watcher->deleteLater();
+		qDebug() << "Done";
+		emit exportFinished(watcher->result());
+	});
 
-		QFile file(dir.absolutePath()+"/"+title+".txt");
-		if (!file.open(QFile::WriteOnly|QFile::Text))
-		{
-			qWarning() << "ERROR: Database: Cannot open file for" << title;
-			continue;
-		}
-
-		file.write(q.value("wikitext").toString().toUtf8());
-	}
+	QString exportPath = dir.absolutePath();
+	_exportJob = runOnOwnConnection(exportConnectionName, [=](QSqlDatabase& exportDb)
+	{
+		return exportChangedPages(exportDb, exportPath);
+	});
+	watcher->setFuture(_exportJob);
 }
 
 void
-Database::updateDatabase(const QJsonArray& wikiData)
+Database::updateDatabase(const QVector<WikiPage>& pages)
 {
-	auto existingIds = allPageIds();
+	// NOTE: This is called once per downloaded chunk. Each chunk is committed
+	//       on its own, so that completed work survives a failure further on.
+	//       Call finalizeUpdate() after the last chunk.
 
 	// TODO: Validate data
 
-	QSqlQuery q;
+	QElapsedTimer writeTimer;
+	writeTimer.start();
+
+	if (pages.isEmpty())
+		return;
+
+	// Loaded before the transaction starts, since loading may write to the table
+	RedirectGraph& graph = redirectGraph();
+
+	QVector<int> pageIds;
+	QVariantList ids;
+	QVariantList titles;
+	QVariantList timestamps;
+	QVariantList redirectTargets;
+	QVector<QString> contents;
+	for (const WikiPage& page : pages)
+	{
+		QString link = _wikiLinks.redirectTarget(page.content);
+
+		pageIds << page.id;
+		ids << page.id;
+		titles << page.title;
+		timestamps << page.touched;
+		redirectTargets << (link.isEmpty() ? QVariant() : QVariant(link));
+		contents << page.content;
+	}
+
+	QSqlQuery q(_db);
 	q.exec("BEGIN");
-	for (const QJsonValue& val : wikiData)
+
+	// A chunk goes in whole or not at all. Its pages stay pending for the next refresh then,
+	// and the graph (which may be ahead of the table by then) is reloaded.
+	auto abortChunk = [&]
 	{
-		auto pageObj = val.toObject();
+		qWarning() << "ERROR: Database: Rolling back a chunk of" << ids.count() << "pages";
+		q.exec("ROLLBACK");
+		forgetRedirectGraph();
+	};
 
-		int pageId = pageObj["pageid"].toInt();
-		QString title = pageObj["title"].toString();
-		QString timestamp = pageObj["touched"].toString();
-		QString content = pageObj["content"].toString();
+	// The checkpoint moves forward together with the data (see DataCoordinator)
+	q.prepare("DELETE FROM PendingPages WHERE id=:id");
+	q.bindValue(":id", ids);
+	if (!q.execBatch())
+	{
+		qWarning() << "ERROR: Database: Updating pending pages:" << q.lastError();
+		abortChunk();
+		return;
+	}
 
-		int redirection = -1;
-		if (content.startsWith("#REDIRECT"))
-		{
-			qDebug() << "Extracting redirect...";
+	// Two passes: all of the chunk's rows go in first, without their redirections. The
+	// redirections are set afterwards (see storeResolutions()), once every target exists.
+	// Checks are deferred to COMMIT all the same, so that no ordering within the chunk can fail it.
+	q.exec("PRAGMA defer_foreign_keys = ON");
 
-			QString link = extractRedirection(content);
-			redirection = idOf(link);
-			if (link.isEmpty() || redirection == -1)
-			{
-				qWarning() << "...not found!:" << link;
-				continue;
-			}
-			qDebug() << "...redirecting to" << redirection << link;
-		}
+	// Must happen before the old title and text are overwritten
+	if (!unindexPages(pageIds))
+	{
+		abortChunk();
+		return;
+	}
 
-		if (existingIds.contains(pageId))
-		{
-			if (!q.prepare("UPDATE Pages SET redirection=:redirection, title=:title, timestamp=:timestamp, wikitext=:wikitext WHERE id=:id"))
-				qWarning() << "ERROR: Database: Preparing Update query:" << q.lastError();
-		}
-		else
-		{
-			if (!q.prepare("INSERT INTO Pages (id, redirection, title, timestamp, wikitext) VALUES(:id, :redirection, :title, :timestamp, :wikitext)"))
-				qWarning() << "ERROR: Database: Preparing Insert query:" << q.lastError();
-		}
-		q.bindValue(":id", pageId);
-		q.bindValue(":title", title);
-		q.bindValue(":timestamp", timestamp);
-		q.bindValue(":wikitext", content);
-		if (redirection == -1)
-			q.bindValue(":redirection", QVariant());
-		else
-			q.bindValue(":redirection", redirection);
-		if (!q.exec())
-			qWarning() << "ERROR: Database: Executing UPDATE/INSERT for page" << title << ":" << q.lastError();
+	_upsertQuery.bindValue(":id", ids);
+	_upsertQuery.bindValue(":title", titles);
+	_upsertQuery.bindValue(":timestamp", timestamps);
+	_upsertQuery.bindValue(":redirectTarget", redirectTargets);
+	if (!_upsertQuery.execBatch())
+	{
+		qWarning() << "ERROR: Database: Executing upsert:" << _upsertQuery.lastError();
+		abortChunk();
+		return;
+	}
+
+	QVariantList compressedContents;
+	for (const QByteArray& compressed : QtConcurrent::blockingMapped(contents, &Database::compressText))
+		compressedContents << compressed;
+	_contentQuery.bindValue(":id", ids);
+	_contentQuery.bindValue(":wikitext", compressedContents);
+	if (!_contentQuery.execBatch())
+	{
+		qWarning() << "ERROR: Database: Storing text:" << _contentQuery.lastError();
+		abortChunk();
+		return;
+	}
+
+	QVariantList texts;
+	for (const QString& content : contents)
+		texts << content;
+	if (!indexPages(ids, titles, texts))
+	{
+		abortChunk();
+		return;
+	}
+
+	// Only the pages in this chunk have changed, so only their links are extracted again
+	QElapsedTimer linkTimer;
+	linkTimer.start();
+	auto links = QtConcurrent::blockingMapped(contents, LinkExtractor{&_wikiLinks});
+	if (!storeLinks(_db, ids, links, titles, timestamps))
+	{
+		abortChunk();
+		return;
+	}
+	if (_metrics)
+		_metrics->observe("link_extraction_ms", linkTimer.elapsed());
+
+	// Only the pages of this chunk, and the redirects that lead to them, are resolved again.
+	// NOTE: A redirect whose target hasn't been downloaded yet stays "broken" until the target arrives.
+	for (int i = 0; i < pageIds.count(); ++i)
+		graph.setPage(pageIds[i], titles[i].toString(), redirectTargets[i].toString());
+	auto resolutions = graph.resolveChanged();
+	if (!storeResolutions(resolutions))
+	{
+		abortChunk();
+		return;
 	}
-	q.exec("COMMIT");
 
-	updateModel();
+	QElapsedTimer commitTimer;
+	commitTimer.start();
+	if (!q.exec("COMMIT"))
+	{
+		qWarning() << "ERROR: Database: Committing:" << q.lastError();
+		abortChunk();
+		return;
+	}
+	if (_metrics)
+	{
+		_metrics->observe("sqlite_commit_ms", commitTimer.elapsed());
+		_metrics->observe("sqlite_chunk_write_ms", writeTimer.elapsed());
+		_metrics->add("pages_stored", ids.count());
+		_metrics->add("redirect_resolutions", resolutions.count());
+	}
+
+	_model->refreshPages(pageIds + resolutions.keys().toVector());
+}
+
+void
+Database::finalizeUpdate(bool interrupted)
+{
+	// The targets of broken redirects might still be among the pages that the resumed refresh will fetch
+	if (interrupted)
+		return;
+
+	reportRedirects();
 }
 
 void
 Database::deletePages(const QVector<int>& pageIds)
 {
-	QSqlQuery q;
+	RedirectGraph& graph = redirectGraph();
+
+	QSqlQuery q(_db);
 	q.exec("BEGIN"); // TODO: Check if many deletions need to be in 1 transaction
+
+	// Redirects to the deleted pages are only updated after the deletions
+	q.exec("PRAGMA defer_foreign_keys = ON");
+
+	// Search hits on pages that are gone would be worse than keeping the pages for now
+	if (!unindexPages(pageIds))
+	{
+		qWarning() << "ERROR: Database: Rolling back the deletion of" << pageIds.count() << "pages";
+		q.exec("ROLLBACK");
+		return;
+	}
 	for (int id : pageIds)
 	{
 		q.prepare("DELETE FROM Pages WHERE id=:id");
 		q.bindValue(":id", id);
 		if (!q.exec())
 			qWarning() << "ERROR: Database: Executing DELETE for page" << id << ":" << q.lastError();
+		graph.removePage(id);
+	}
+	auto resolutions = graph.resolveChanged();
+	if (!storeResolutions(resolutions) || !q.exec("COMMIT"))
+	{
+		qWarning() << "ERROR: Database: Committing deletions:" << q.lastError();
+		q.exec("ROLLBACK");
+		forgetRedirectGraph();
+		return;
+	}
+
+	_model->removePages(pageIds);
+	_model->refreshPages(resolutions.keys().toVector());
+}
+
+QString
+Database::syncState(const QString& key) const
+{
+	QSqlQuery q(_db);
+	q.prepare("SELECT value FROM SyncState WHERE key=:key");
+	q.bindValue(":key", key);
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Loading sync state" << key << ":" << q.lastError();
+	if (q.next())
+		return q.value(0).toString();
+	return "";
+}
+
+void
+Database::setSyncState(const QString& key, const QString& value)
+{
+	QSqlQuery q(_db);
+	q.prepare("INSERT OR REPLACE INTO SyncState (key, value) VALUES(:key, :value)");
+	q.bindValue(":key", key);
+	q.bindValue(":value", value);
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Storing sync state" << key << ":" << q.lastError();
+}
+
+void
+Database::setSiteInfo(const QJsonObject& siteInfo)
+{
+	QString json = QString::fromUtf8(QJsonDocument(siteInfo).toJson(QJsonDocument::Compact));
+	if (json == syncState(siteInfoKey))
+		return;
+
+	_wikiLinks = WikiLinks::fromSiteInfo(siteInfo);
+	setSyncState(siteInfoKey, json);
+	if (hasPages())
+	{
+		qDebug() << "The wiki's redirect and link syntax has changed. Everything will be extracted again on the next scan.";
+		setSyncState(linkExtractorVersionKey, QString());
+	}
+}
+
+void
+Database::checkpointListing(const QVector<int>& listedIds, const QVector<int>& changedIds, const QString& resumePoint)
+{
+	QSqlQuery q(_db);
+	q.exec("BEGIN");
+
+	QVariantList listed;
+	for (int id : listedIds)
+		listed << id;
+	if (!listed.isEmpty())
+	{
+		q.prepare("INSERT OR IGNORE INTO ListedPages (id) VALUES(:id)");
+		q.bindValue(":id", listed);
+		if (!q.execBatch())
+			qWarning() << "ERROR: Database: Storing listed pages:" << q.lastError();
 	}
+	addPendingPages(changedIds);
+	setSyncState(listingResumeKey, resumePoint);
+
+	if (!q.exec("COMMIT"))
+		qWarning() << "ERROR: Database: Committing listing checkpoint:" << q.lastError();
+}
+
+QString
+Database::listingResumePoint() const
+{
+	return syncState(listingResumeKey);
+}
+
+QVector<int>
+Database::listedPages() const
+{
+	return idsIn("ListedPages");
+}
+
+void
+Database::addPendingPages(const QVector<int>& pageIds)
+{
+	QVariantList ids;
+	for (int id : pageIds)
+		ids << id;
+	if (ids.isEmpty())
+		return;
+
+	QSqlQuery q(_db);
+	q.prepare("INSERT OR IGNORE INTO PendingPages (id) VALUES(:id)");
+	q.bindValue(":id", ids);
+	if (!q.execBatch())
+		qWarning() << "ERROR: Database: Storing pending pages:" << q.lastError();
+}
+
+QVector<int>
+Database::pendingPages() const
+{
+	return idsIn("PendingPages");
+}
+
+void
+Database::clearCheckpoint()
+{
+	QSqlQuery q(_db);
+	q.exec("BEGIN");
+	if (!q.exec("DELETE FROM ListedPages") || !q.exec("DELETE FROM PendingPages"))
+		qWarning() << "ERROR: Database: Clearing checkpoint:" << q.lastError();
+	setSyncState(listingResumeKey, QString());
 	q.exec("COMMIT");
+}
+
+QVector<SearchHit>
+Database::search(const QString& query, int limit) const
+{
+	QVector<SearchHit> hits;
+	if (!_searchAvailable)
+	{
+		qWarning() << "ERROR: Database: Full-text search is not available";
+		return hits;
+	}
+
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	q.prepare("SELECT rowid, " + searchRanking + " AS score FROM SearchIndex "
+			"WHERE SearchIndex MATCH :query ORDER BY score LIMIT :limit");
+	q.bindValue(":query", query);
+	q.bindValue(":limit", limit);
+	if (!q.exec())
+	{
+		qWarning() << "ERROR: Database: Searching for" << query << ":" << q.lastError();
+		return hits;
+	}
+	while (q.next())
+		hits << SearchHit{q.value(0).toInt(), QString(), QString(), q.value(1).toDouble()};
+
+	// The index is contentless, so snippets are cut from the stored text. Only done for the hits.
+	QStringList terms = query.split(QRegularExpression("[^\\w]+"), QString::SkipEmptyParts);
+	terms.removeAll("AND");
+	terms.removeAll("OR");
+	terms.removeAll("NOT");
+	terms.removeAll("NEAR");
+
+	q.prepare("SELECT Pages.title, Content.wikitext FROM Pages LEFT JOIN Content ON Content.id = Pages.id WHERE Pages.id=:id");
+	for (SearchHit& hit : hits)
+	{
+		q.bindValue(":id", hit.pageId);
+		if (!q.exec() || !q.next())
+			continue;
+		hit.title = q.value(0).toString();
+		hit.snippet = makeSnippet(QString::fromUtf8(qUncompress(q.value(1).toByteArray())), terms);
+	}
+	return hits;
+}
+
+int
+Database::finalTargetOf(int pageId) const
+{
+	QSqlQuery q(_db);
+	q.prepare("SELECT finalTarget FROM Pages WHERE id=:id");
+	q.bindValue(":id", pageId);
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Loading final target of page" << pageId << ":" << q.lastError();
+	if (q.next() && !q.value(0).isNull())
+		return q.value(0).toInt();
+	return -1;
+}
+
+QVector<int>
+Database::redirectsWithStatus(RedirectGraph::Status status) const
+{
+	QVector<int> ids;
+	if (status == RedirectGraph::NotRedirect)
+		return ids;
+
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	q.prepare("SELECT id FROM Pages WHERE redirectStatus=:status ORDER BY id");
+	q.bindValue(":status", RedirectGraph::statusName(status));
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Loading redirects with status" << RedirectGraph::statusName(status) << ":" << q.lastError();
+	while (q.next())
+		ids << q.value(0).toInt();
+	return ids;
+}
+
+QVector<int>
+Database::backlinks(int pageId) const
+{
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	q.prepare("SELECT DISTINCT from_id FROM Links WHERE to_id=:id ORDER BY from_id");
+	q.bindValue(":id", pageId);
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Loading backlinks of page" << pageId << ":" << q.lastError();
 
-	updateModel();
+	QVector<int> ids;
+	while (q.next())
+		ids << q.value(0).toInt();
+	return ids;
+}
+
+QVector<int>
+Database::orphanPages() const
+{
+	// Links from a page to itself don't count
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT id FROM Pages WHERE redirectTarget IS NULL "
+			"AND NOT EXISTS (SELECT 1 FROM Links WHERE to_id = Pages.id AND from_id != Pages.id) "
+			"ORDER BY id"))
+	{
+		qWarning() << "ERROR: Database: Loading orphan pages:" << q.lastError();
+	}
+
+	QVector<int> ids;
+	while (q.next())
+		ids << q.value(0).toInt();
+	return ids;
+}
+
+QVector<WantedPage>
+Database::danglingLinks(int limit) const
+{
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	q.prepare("SELECT to_title, COUNT(DISTINCT from_id) AS linkCount FROM Links WHERE to_id IS NULL "
+			"GROUP BY to_title ORDER BY linkCount DESC, to_title LIMIT :limit");
+	q.bindValue(":limit", limit);
+	if (!q.exec())
+		qWarning() << "ERROR: Database: Loading dangling links:" << q.lastError();
+
+	QVector<WantedPage> pages;
+	while (q.next())
+		pages << WantedPage{q.value(0).toString(), q.value(1).toInt()};
+	return pages;
 }
 
 void
 Database::deepScanForRedirects()
 {
+	if (_scanJob.isRunning())
+	{
+		qDebug() << "ERROR: Database: A redirection scan is already running.";
+		emit redirectScanFinished(false);
+		return;
+	}
+
 	qDebug("== Deep scanning for redirections ==");
-	QSqlQuery q;
-	q.exec("SELECT id,wikitext FROM Pages");
 
-	QSqlQuery r;
-	r.exec("BEGIN");
+	// The scan runs on its own connection in a worker thread, so the GUI stays responsive
+	auto changedIds = std::make_shared<QVector<int>>();
+	auto watcher = new QFutureWatcher<bool>(this);
+	connect(watcher, &QFutureWatcher<bool>::finished, [=]
+	{
+		watcher->deleteLater();
+
+		// The worker only rewrote the redirect targets. Resolve them all again from scratch.
+		forgetRedirectGraph();
+		redirectGraph();
+		reportRedirects();
+
+		qDebug() << "Done";
+		_model->refreshPages(*changedIds);
+		emit redirectScanFinished(watcher->result());
+	});
+
+	WikiLinks wikiLinks = _wikiLinks;
+	_scanJob = runOnOwnConnection(scanConnectionName, [=](QSqlDatabase& scanDb)
+	{
+		return scanForRedirects(scanDb, wikiLinks, *changedIds);
+	});
+	watcher->setFuture(_scanJob);
+}
+
+bool
+Database::extractionIsOutdated() const
+{
+	return syncState(linkExtractorVersionKey) != linkExtractorVersion;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+bool
+Database::hasPages() const
+{
+	QSqlQuery q(_db);
+	return q.exec("SELECT 1 FROM Pages LIMIT 1") && q.next();
+}
+
+QVector<int>
+Database::idsIn(const QString& table) const
+{
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec(QString("SELECT id FROM %1 ORDER BY id").arg(table)))
+		qWarning() << "ERROR: Database: Loading IDs from" << table << ":" << q.lastError();
+
+	QVector<int> ids;
+	while (q.next())
+		ids << q.value(0).toInt();
+	return ids;
+}
+
+RedirectGraph&
+Database::redirectGraph()
+{
+	if (_redirectGraphLoaded)
+		return _redirectGraph;
+
+	// One pass over the table. What's already stored is only written again if it's out of date.
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT id, title, redirectTarget, redirection, finalTarget, redirectStatus FROM Pages"))
+		qWarning() << "ERROR: Database: Loading redirect graph:" << q.lastError();
+
+	_redirectGraph.clear();
+	QHash<int, RedirectGraph::Resolution> stored;
+	while (q.next())
+	{
+		int id = q.value(0).toInt();
+		_redirectGraph.setPage(id, q.value(1).toString(), q.value(2).toString());
+		stored.insert(id, RedirectGraph::Resolution{
+				q.value(3).isNull() ? -1 : q.value(3).toInt(),
+				q.value(4).isNull() ? -1 : q.value(4).toInt(),
+				RedirectGraph::statusFromName(q.value(5).toString())});
+	}
+	_redirectGraphLoaded = true;
+
+	auto resolutions = _redirectGraph.resolveChanged();
+	for (auto it = resolutions.begin(); it != resolutions.end();)
+	{
+		if (stored.value(it.key()) == it.value())
+			it = resolutions.erase(it);
+		else
+			++it;
+	}
+	if (resolutions.isEmpty())
+		return _redirectGraph;
+
+	qDebug() << "Updating" << resolutions.count() << "out-of-date redirect resolutions...";
+	q.exec("BEGIN");
+	q.exec("PRAGMA defer_foreign_keys = ON");
+	if (!storeResolutions(resolutions) || !q.exec("COMMIT"))
+	{
+		qWarning() << "ERROR: Database: Committing redirect resolutions:" << q.lastError();
+		q.exec("ROLLBACK");
+	}
+	_model->refreshPages(resolutions.keys().toVector());
+	return _redirectGraph;
+}
+
+bool
+Database::storeResolutions(const QHash<int, RedirectGraph::Resolution>& resolutions)
+{
+	// NOTE: Runs inside the caller's transaction
+	if (resolutions.isEmpty())
+		return true;
+
+	QVariantList ids;
+	QVariantList redirections;
+	QVariantList finalTargets;
+	QVariantList statuses;
+	for (auto it = resolutions.constBegin(); it != resolutions.constEnd(); ++it)
+	{
+		const auto& r = it.value();
+		ids << it.key();
+		redirections << (r.target == -1 ? QVariant() : QVariant(r.target));
+		finalTargets << (r.finalTarget == -1 ? QVariant() : QVariant(r.finalTarget));
+		statuses << (r.status == RedirectGraph::NotRedirect ? QVariant() : QVariant(RedirectGraph::statusName(r.status)));
+	}
+
+	QSqlQuery q(_db);
+	q.prepare("UPDATE Pages SET redirection=:redirection, finalTarget=:finalTarget, redirectStatus=:status WHERE id=:id");
+	q.bindValue(":redirection", redirections);
+	q.bindValue(":finalTarget", finalTargets);
+	q.bindValue(":status", statuses);
+	q.bindValue(":id", ids);
+	if (!q.execBatch())
+	{
+		qWarning() << "ERROR: Database: Storing" << ids.count() << "redirect resolutions:" << q.lastError();
+		return false;
+	}
+	return true;
+}
+
+void
+Database::reportRedirects()
+{
+	const RedirectGraph& graph = redirectGraph();
+	int doubles = graph.count(RedirectGraph::DoubleRedirect);
+	int broken = graph.count(RedirectGraph::Broken);
+	int loops = graph.count(RedirectGraph::Loop);
+
+	qDebug() << "Redirects:" << graph.count(RedirectGraph::Resolved) << "resolved,"
+			<< doubles << "double," << broken << "broken," << loops << "in loops.";
+	if (broken > 0 || loops > 0)
+		qWarning() << "Found" << broken << "broken redirects and" << loops << "redirect loops";
+
+	if (_metrics)
+	{
+		_metrics->setGauge("redirects_double", doubles);
+		_metrics->setGauge("redirects_broken", broken);
+		_metrics->setGauge("redirects_loop", loops);
+	}
+}
+
+QFuture<bool>
+Database::runOnOwnConnection(const QString& connectionName, const std::function<bool(QSqlDatabase&)>& job) const
+{
+	// QSqlDatabase connections can't be shared between threads, so each worker opens its own.
+	// Named after this database's connection too, since every wiki has a Database of its own.
+	QString dbPath = _db.databaseName();
+	QString workerConnectionName = connectionName + "/" + _db.connectionName();
+	return QtConcurrent::run([=]
+	{
+		bool ok = false;
+		{
+			auto workerDb = QSqlDatabase::addDatabase("QSQLITE", workerConnectionName);
+			workerDb.setDatabaseName(dbPath);
+			workerDb.setConnectOptions("QSQLITE_BUSY_TIMEOUT=10000");
+			if (workerDb.open())
+				ok = job(workerDb);
+			else
+				qWarning() << "ERROR: Database: Failed to open" << dbPath << "for" << connectionName << ":" << workerDb.lastError();
+		}
+		QSqlDatabase::removeDatabase(workerConnectionName);
+		return ok;
+	});
+}
+
+bool
+Database::exportChangedPages(QSqlDatabase& exportDb, const QString& exportPath) const
+{
+	// NOTE: Runs in a worker thread. Only touch exportDb here.
+
+	// The manifest records which file and timestamp was exported for each page ID
+	QJsonObject oldManifest;
+	QFile manifestFile(exportPath + "/" + exportManifestName);
+	if (manifestFile.open(QFile::ReadOnly))
+		oldManifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+	manifestFile.close();
+
+	QJsonObject newManifest;
+	QSet<QString> currentFiles; // In lower case, for case-insensitive file systems
+	QVector<int> changedIds;
+	QHash<int, QString> changedFiles;
+
+	// NOTE: In ID order, so that the same page keeps the plain name from one export to the next
+	QSqlQuery q(exportDb);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT id, title, timestamp FROM Pages ORDER BY id"))
+	{
+		qWarning() << "ERROR: Database: Loading metadata for export:" << q.lastError();
+		return false;
+	}
 	while (q.next())
 	{
-		// This function takes quite a while.
-		// Manually process events to keep the GUI responsive.
-		qApp->processEvents();
+		int id = q.value(0).toInt();
+		QString title = q.value(1).toString();
+		QString timestamp = q.value(2).toString();
+
+		title.replace('/', "__");
+		title.replace(':', "__"); // TODO: (Wiki) Fix weird Categories
+		QString fileName = title + ".txt";
+
+		// e.g. "A/B" and "A:B", or "iPhone" and "IPhone". Later pages get their ID appended.
+		while (currentFiles.contains(fileName.toLower()))
+		{
+			title += '-' + QString::number(id);
+			fileName = title + ".txt";
+		}
+		currentFiles << fileName.toLower();
+
+		QString key = QString::number(id);
+		auto oldEntry = oldManifest.value(key).toObject();
+		if (oldEntry["file"].toString() != fileName
+				|| oldEntry["timestamp"].toString() != timestamp
+				|| !QFile::exists(exportPath + "/" + fileName))
+		{
+			changedIds << id;
+			changedFiles[id] = fileName;
+		}
+
+		QJsonObject entry;
+		entry["file"] = fileName;
+		entry["timestamp"] = timestamp;
+		newManifest[key] = entry;
+	}
+
+	// Only load the text of changed pages, and write each block of files in parallel
+	int failures = 0;
+	for (int i = 0; i < changedIds.count(); i += exportBlockSize)
+	{
+		QStringList idStrings;
+		for (int id : changedIds.mid(i, exportBlockSize))
+			idStrings << QString::number(id);
+
+		QVector<ExportFile> files;
+		if (!q.exec("SELECT id, wikitext FROM Content WHERE id IN (" + idStrings.join(',') + ")"))
+		{
+			qWarning() << "ERROR: Database: Loading text for export:" << q.lastError();
+			return false;
+		}
+		while (q.next())
+			files << ExportFile{exportPath + "/" + changedFiles[q.value(0).toInt()], q.value(1).toByteArray()};
+
+		auto results = QtConcurrent::blockingMapped(files, &Database::writeExportFile);
+		failures += results.count(false);
+		if (_metrics)
+			_metrics->add("pages_exported", results.count(true));
+	}
+
+	// Remove files of deleted or renamed pages
+	int removals = 0;
+	for (auto it = oldManifest.constBegin(); it != oldManifest.constEnd(); ++it)
+	{
+		QString fileName = it.value().toObject()["file"].toString();
+		if (fileName.isEmpty() || currentFiles.contains(fileName.toLower()))
+			continue;
+		if (QFile::remove(exportPath + "/" + fileName))
+			++removals;
+	}
+
+	QSaveFile newManifestFile(exportPath + "/" + exportManifestName);
+	if (!newManifestFile.open(QFile::WriteOnly)
+			|| newManifestFile.write(QJsonDocument(newManifest).toJson(QJsonDocument::Compact)) < 0
+			|| !newManifestFile.commit())
+	{
+		qWarning() << "ERROR: Database: Cannot write export manifest:" << newManifestFile.errorString();
+		return false;
+	}
 
-		int id = q.value("id").toInt();
-		QString wikiText = q.value("wikitext").toString();
+	qDebug() << "...Wrote" << changedIds.count() - failures << "changed pages,"
+			<< "removed" << removals << "stale files,"
+			<< newManifest.count() - changedIds.count() << "pages unchanged.";
+	return failures == 0;
+}
 
-		int redirection = -1;
-		if (wikiText.startsWith("#REDIRECT"))
+bool
+Database::writeExportFile(const ExportFile& exportFile)
+{
+	QFile file(exportFile.path);
+	if (!file.open(QFile::WriteOnly|QFile::Text))
+	{
+		qWarning() << "ERROR: Database: Cannot open file" << exportFile.path;
+		return false;
+	}
+	return file.write(qUncompress(exportFile.compressedText)) >= 0;
+}
+
+bool
+Database::scanForRedirects(QSqlDatabase& scanDb, const WikiLinks& wikiLinks, QVector<int>& changedIds) const
+{
+	// NOTE: Runs in a worker thread. Only touch scanDb here.
+	//       changedIds receives the IDs of the pages whose redirect target was changed.
+	//       Resolving the targets is left to the RedirectGraph, back in the main thread.
+	//       Links are only extracted again for pages that changed since their last extraction.
+
+	QSqlQuery q(scanDb);
+	q.setForwardOnly(true);
+	q.prepare("SELECT value FROM SyncState WHERE key=:key");
+	q.bindValue(":key", linkExtractorVersionKey);
+	bool allLinksStale = !q.exec() || !q.next() || q.value(0).toString() != linkExtractorVersion;
+
+	// Load the current state of the table (minus the heavy text)
+	QHash<int, QString> oldTargets;
+	QHash<int, QPair<QString, QString>> staleLinks; // ID -> (Title, Timestamp)
+	if (!q.exec("SELECT Pages.id, Pages.redirectTarget, Pages.title, Pages.timestamp, LinksExtracted.timestamp "
+			"FROM Pages LEFT JOIN LinksExtracted ON LinksExtracted.id = Pages.id"))
+	{
+		qWarning() << "ERROR: Database: Loading redirect targets for scan:" << q.lastError();
+		return false;
+	}
+	while (q.next())
+	{
+		int id = q.value(0).toInt();
+		oldTargets.insert(id, q.value(1).toString());
+		if (allLinksStale || q.value(4).isNull() || q.value(4).toString() != q.value(3).toString())
+			staleLinks.insert(id, qMakePair(q.value(2).toString(), q.value(3).toString()));
+	}
+	const int total = oldTargets.count();
+
+	// Extract links in parallel, one block at a time to keep memory use bounded.
+	// Only remember the pages whose redirect target actually changes.
+	QVector<QPair<int, QString>> changes; // (ID, New target)
+	QVariantList linkIds;
+	QVector<QStringList> links;
+	QVariantList linkTitles;
+	QVariantList linkTimestamps;
+	QVector<int> ids;
+	QVector<QByteArray> texts;
+	int scanned = 0;
+	auto processBlock = [&]
+	{
+		auto targets = QtConcurrent::blockingMapped(texts, RedirectExtractor{&wikiLinks});
+		QVector<QByteArray> staleTexts;
+		for (int i = 0; i < ids.count(); ++i)
 		{
-			QString link = extractRedirection(wikiText);
-			redirection = idOf(link);
-			if (redirection == -1)
-				qWarning() << link << "not found in the main table!";
+			if (targets[i] != oldTargets.value(ids[i]))
+				changes << qMakePair(ids[i], targets[i]);
+
+			auto it = staleLinks.constFind(ids[i]);
+			if (it == staleLinks.constEnd())
+				continue;
+			staleTexts << texts[i];
+			linkIds << ids[i];
+			linkTitles << it.value().first;
+			linkTimestamps << it.value().second;
 		}
-		r.prepare("UPDATE Pages SET redirection=:redirection WHERE id=:id");
+		links += QtConcurrent::blockingMapped(staleTexts, LinkExtractor{&wikiLinks});
+
+		scanned += ids.count();
+		if (_metrics)
+			_metrics->add("pages_scanned", ids.count());
+		emit redirectScanProgress(scanned, total);
+		ids.clear();
+		texts.clear();
+	};
 
-		r.bindValue(":id", id);
-		if (redirection == -1)
-			r.bindValue(":redirection", QVariant());
+	if (!q.exec("SELECT id, wikitext FROM Content"))
+	{
+		qWarning() << "ERROR: Database: Loading text for scan:" << q.lastError();
+		return false;
+	}
+	while (q.next())
+	{
+		ids << q.value(0).toInt();
+		texts << q.value(1).toByteArray();
+		if (ids.count() == scanBlockSize)
+			processBlock();
+	}
+	if (!ids.isEmpty())
+		processBlock();
+
+	qDebug() << "Updating" << changes.count() << "changed redirect targets,"
+			<< "and the links of" << linkIds.count() << "pages...";
+
+	QSqlQuery r(scanDb);
+	r.exec("BEGIN");
+	if (!changes.isEmpty() && !r.prepare("UPDATE Pages SET redirectTarget=:target WHERE id=:id"))
+		qWarning() << "ERROR: Database: Preparing redirect target update:" << r.lastError();
+	for (const auto& change : changes)
+	{
+		r.bindValue(":id", change.first);
+		if (change.second.isEmpty())
+			r.bindValue(":target", QVariant());
+		else
+			r.bindValue(":target", change.second);
+
+		if (!r.exec())
+			qWarning() << "ERROR: Database: Updating/Inserting derived data for" << change.first;
 		else
-			r.bindValue(":redirection", redirection);
+			changedIds << change.first;
+	}
 
+	bool linksStored = storeLinks(scanDb, linkIds, links, linkTitles, linkTimestamps);
+	if (linksStored)
+	{
+		r.prepare("INSERT OR REPLACE INTO SyncState (key, value) VALUES(:key, :value)");
+		r.bindValue(":key", linkExtractorVersionKey);
+		r.bindValue(":value", linkExtractorVersion);
 		if (!r.exec())
-			qWarning() << "ERROR: Database: Updating/Inserting derived data for" << id;
+			qWarning() << "ERROR: Database: Storing link extractor version:" << r.lastError();
 	}
-	r.exec("COMMIT");
 
-	qDebug() << "Done";
-	updateModel();
+	QElapsedTimer commitTimer;
+	commitTimer.start();
+	bool committed = r.exec("COMMIT");
+	if (_metrics)
+	{
+		_metrics->observe("sqlite_commit_ms", commitTimer.elapsed());
+		_metrics->add("redirects_changed", changedIds.count());
+	}
+	return committed && linksStored;
+}
+
+bool
+Database::storeLinks(QSqlDatabase& db, const QVariantList& ids, const QVector<QStringList>& links,
+		const QVariantList& titles, const QVariantList& timestamps) const
+{
+	// NOTE: Runs inside the caller's transaction, possibly in a worker thread
+	if (ids.isEmpty())
+		return true;
+
+	QVariantList fromIds;
+	QVariantList toTitles;
+	for (int i = 0; i < ids.count(); ++i)
+	{
+		for (const QString& link : links[i])
+		{
+			fromIds << ids[i];
+			toTitles << link;
+		}
+	}
+
+	QSqlQuery q(db);
+	bool ok = q.prepare("DELETE FROM Links WHERE from_id=:id");
+	q.bindValue(":id", ids);
+	ok = ok && q.execBatch();
+	if (ok && !fromIds.isEmpty())
+	{
+		ok = q.prepare("INSERT INTO Links (from_id, to_title) VALUES(:from, :to)");
+		q.bindValue(":from", fromIds);
+		q.bindValue(":to", toTitles);
+		ok = ok && q.execBatch();
+	}
+
+	// Point the new links at their pages, and re-point the links to these pages' (old and new) titles
+	if (ok)
+	{
+		ok = q.prepare("UPDATE Links SET to_id=(SELECT id FROM Pages WHERE Pages.title = Links.to_title) "
+				"WHERE from_id=:from OR to_id=:to OR to_title=:title");
+		q.bindValue(":from", ids);
+		q.bindValue(":to", ids);
+		q.bindValue(":title", titles);
+		ok = ok && q.execBatch();
+	}
+	if (ok)
+	{
+		ok = q.prepare("INSERT OR REPLACE INTO LinksExtracted (id, timestamp) VALUES(:id, :timestamp)");
+		q.bindValue(":id", ids);
+		q.bindValue(":timestamp", timestamps);
+		ok = ok && q.execBatch();
+	}
+	if (!ok)
+	{
+		qWarning() << "ERROR: Database: Storing links of" << ids.count() << "pages:" << q.lastError();
+		return false;
+	}
+
+	if (_metrics)
+	{
+		_metrics->add("link_pages_extracted", ids.count());
+		_metrics->add("links_stored", fromIds.count());
+	}
+	return true;
 }
 
-/**********************************************************************\
- * PRIVATE
-\**********************************************************************/
 void
-Database::updateModel()
+Database::createSearchIndex()
+{
+	QSqlQuery q(_db);
+	q.exec("SELECT name FROM sqlite_master WHERE type='table' AND name='SearchIndex'");
+	if (q.next())
+	{
+		_searchAvailable = true;
+		return;
+	}
+
+	// Not every SQLite build comes with FTS5
+	if (!q.exec(createSearchTable))
+	{
+		qWarning() << "ERROR: Database: Creating search index (is FTS5 available?):" << q.lastError();
+		return;
+	}
+	_searchAvailable = true;
+
+	// Existing databases need to have their pages indexed once
+	qDebug() << "Building search index...";
+	q.exec("BEGIN");
+
+	QSqlQuery r(_db);
+	r.setForwardOnly(true);
+	if (!r.exec("SELECT Pages.id, Pages.title, Content.wikitext FROM Pages JOIN Content ON Content.id = Pages.id"))
+		qWarning() << "ERROR: Database: Loading text for search index:" << r.lastError();
+
+	QVariantList ids;
+	QVariantList titles;
+	QVariantList texts;
+	while (r.next())
+	{
+		ids << r.value(0);
+		titles << r.value(1);
+		texts << QString::fromUtf8(qUncompress(r.value(2).toByteArray()));
+		if (ids.count() == scanBlockSize)
+		{
+			indexPages(ids, titles, texts);
+			ids.clear();
+			titles.clear();
+			texts.clear();
+		}
+	}
+	indexPages(ids, titles, texts);
+	q.exec("COMMIT");
+	qDebug() << "...Done.";
+}
+
+bool
+Database::indexPages(const QVariantList& ids, const QVariantList& titles, const QVariantList& texts)
+{
+	if (!_searchAvailable || ids.isEmpty())
+		return true;
+
+	QSqlQuery q(_db);
+	q.prepare("INSERT INTO SearchIndex(rowid, title, wikitext) VALUES(:id, :title, :wikitext)");
+	q.bindValue(":id", ids);
+	q.bindValue(":title", titles);
+	q.bindValue(":wikitext", texts);
+	if (!q.execBatch())
+	{
+		qWarning() << "ERROR: Database: Indexing" << ids.count() << "pages:" << q.lastError();
+		return false;
+	}
+	return true;
+}
+
+bool
+Database::unindexPages(const QVector<int>& pageIds)
 {
+	if (!_searchAvailable || pageIds.isEmpty())
+		return true;
+
+	// A contentless FTS5 table can only forget a row if it is given the exact old values
+	QStringList idStrings;
+	for (int id : pageIds)
+		idStrings << QString::number(id);
 
-	// Blocking modelAboutToBeReset()/modelReset() signals helps
-	// to maintain the views' sort order and scroll position...
-	// ...but it also blocks the view from adding new rows :(
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT Pages.id, Pages.title, Content.wikitext FROM Pages JOIN Content ON Content.id = Pages.id "
+			"WHERE Pages.id IN (" + idStrings.join(',') + ")"))
+	{
+		qWarning() << "ERROR: Database: Loading old text for search index:" << q.lastError();
+		return false;
+	}
 
-	QSqlQuery q("SELECT id, redirection, timestamp, title FROM Pages");
+	QVariantList ids;
+	QVariantList titles;
+	QVariantList texts;
+	while (q.next())
+	{
+		ids << q.value(0);
+		titles << q.value(1);
+		texts << QString::fromUtf8(qUncompress(q.value(2).toByteArray()));
+	}
+	if (ids.isEmpty())
+		return true;
 
-//	_model->blockSignals(true);
-	_model->setQuery(q);
-	while (_model->canFetchMore())
-		_model->fetchMore();
-//	_model->blockSignals(false);
+	QSqlQuery r(_db);
+	r.prepare("INSERT INTO SearchIndex(SearchIndex, rowid, title, wikitext) VALUES('delete', :id, :title, :wikitext)");
+	r.bindValue(":id", ids);
+	r.bindValue(":title", titles);
+	r.bindValue(":wikitext", texts);
+	if (!r.execBatch())
+	{
+		qWarning() << "ERROR: Database: Removing" << ids.count() << "pages from search index:" << r.lastError();
+		return false;
+	}
+	return true;
 }
 
 QString
-Database::extractRedirection(const QString& wikiText) const
+Database::makeSnippet(const QString& wikiText, const QStringList& terms)
+{
+	// Centre the snippet on the earliest match of any term
+	int matchPos = -1;
+	for (const QString& term : terms)
+	{
+		int pos = wikiText.indexOf(term, 0, Qt::CaseInsensitive);
+		if (pos != -1 && (matchPos == -1 || pos < matchPos))
+			matchPos = pos;
+	}
+	if (matchPos == -1)
+		matchPos = 0;
+
+	int start = qMax(0, matchPos - snippetRadius);
+	int end = qMin(wikiText.length(), matchPos + snippetRadius);
+	QString snippet = wikiText.mid(start, end - start).simplified();
+	if (start > 0)
+		snippet.prepend("...");
+	if (end < wikiText.length())
+		snippet.append("...");
+	return snippet;
+}
+
+void
+Database::moveTextOutOfPages()
+{
+	QSqlQuery q(_db);
+	bool hasInlineText = false;
+	q.exec("PRAGMA table_info(Pages)");
+	while (q.next())
+		if (q.value("name").toString() == "wikitext")
+			hasInlineText = true;
+	if (!hasInlineText)
+		return;
+
+	qDebug() << "Moving wikitext out of the Pages table...";
+
+	QSqlQuery r(_db);
+	QVariantList redirectIds;
+	QVariantList redirectTargets;
+	bool ok = q.exec("BEGIN")
+			&& q.exec(createContentTable)
+			&& r.prepare("INSERT OR REPLACE INTO Content (id, wikitext) VALUES(:id, :wikitext)")
+			&& q.exec("SELECT id, wikitext FROM Pages");
+	while (ok && q.next())
+	{
+		QString wikiText = q.value(1).toString();
+		r.bindValue(":id", q.value(0));
+		r.bindValue(":wikitext", compressText(wikiText));
+		ok = r.exec();
+
+		// The new table comes with the redirect columns, so addRedirectColumns() won't fill them in
+		QString link = _wikiLinks.redirectTarget(wikiText);
+		if (!link.isEmpty())
+		{
+			redirectIds << q.value(0);
+			redirectTargets << link;
+		}
+	}
+
+	// SQLite can't drop columns (before 3.35), so rebuild the table instead
+	ok = ok
+			&& q.exec(createPageTable.arg("Pages_new"))
+			&& q.exec("INSERT INTO Pages_new (id, redirection, title, timestamp) SELECT id, redirection, title, timestamp FROM Pages")
+			&& q.exec("DROP TABLE Pages")
+			&& q.exec("ALTER TABLE Pages_new RENAME TO Pages");
+	if (ok && !redirectIds.isEmpty())
+	{
+		ok = r.prepare("UPDATE Pages SET redirectTarget=:target WHERE id=:id");
+		r.bindValue(":target", redirectTargets);
+		r.bindValue(":id", redirectIds);
+		ok = ok && r.execBatch();
+	}
+	ok = ok && q.exec("COMMIT");
+	if (!ok)
+	{
+		qWarning() << "ERROR: Database: Moving wikitext:" << q.lastError() << r.lastError();
+		q.exec("ROLLBACK");
+		return;
+	}
+
+	// Give the space back to the file system
+	if (!q.exec("VACUUM"))
+		qWarning() << "ERROR: Database: Compacting database:" << q.lastError();
+	qDebug() << "...Done.";
+}
+
+void
+Database::addRedirectColumns()
 {
-	if (!wikiText.startsWith("#REDIRECT"))
-		return "";
+	QSqlQuery q(_db);
+	bool hasRedirectColumns = false;
+	q.exec("PRAGMA table_info(Pages)");
+	while (q.next())
+		if (q.value("name").toString() == "redirectTarget")
+			hasRedirectColumns = true;
+	if (hasRedirectColumns)
+		return;
 
-	// ASSUMPTION: "#REDIRECT" is always followed by a wikilink
-	QRegularExpression regex_wikiLink("\\[\\[(.*?)\\]\\]");
-	auto match = regex_wikiLink.match(wikiText);
-	if (!match.hasMatch())
-		return "";
+	qDebug() << "Adding redirect columns to the Pages table...";
 
-	QString link = match.captured(1);
+	// Only the resolved IDs used to be stored, so the targets have to be read from the text again
+	QSqlQuery r(_db);
+	bool ok = q.exec("BEGIN")
+			&& q.exec("ALTER TABLE Pages ADD COLUMN redirectTarget TEXT")
+			&& q.exec("ALTER TABLE Pages ADD COLUMN finalTarget INTEGER")
+			&& q.exec("ALTER TABLE Pages ADD COLUMN redirectStatus TEXT")
+			&& r.prepare("UPDATE Pages SET redirectTarget=:target WHERE id=:id");
+	q.setForwardOnly(true);
+	ok = ok && q.exec("SELECT id, wikitext FROM Content");
 
-	// Normalize title
-	link.replace("_", " ");
+	QVector<int> ids;
+	QVector<QByteArray> texts;
+	auto processBlock = [&]
+	{
+		auto links = QtConcurrent::blockingMapped(texts, RedirectExtractor{&_wikiLinks});
+		QVariantList redirectIds;
+		QVariantList redirectTargets;
+		for (int i = 0; i < ids.count(); ++i)
+		{
+			if (links[i].isEmpty())
+				continue;
+			redirectIds << ids[i];
+			redirectTargets << links[i];
+		}
+		if (!redirectIds.isEmpty())
+		{
+			r.bindValue(":target", redirectTargets);
+			r.bindValue(":id", redirectIds);
+			ok = r.execBatch();
+		}
+		ids.clear();
+		texts.clear();
+	};
+	while (ok && q.next())
+	{
+		ids << q.value(0).toInt();
+		texts << q.value(1).toByteArray();
+		if (ids.count() == scanBlockSize)
+			processBlock();
+	}
+	if (ok && !ids.isEmpty())
+		processBlock();
 
-	// Handle links to category pages
-	if (link.startsWith(":Category"))
-		link = link.mid(1);
+	// Superseded by redirectTarget
+	ok = ok
+			&& q.exec("DROP TABLE IF EXISTS PendingRedirects")
+			&& q.exec("COMMIT");
+	if (!ok)
+	{
+		qWarning() << "ERROR: Database: Adding redirect columns:" << q.lastError() << r.lastError();
+		q.exec("ROLLBACK");
+		return;
+	}
 
-	return link;
+	// Fill in the derived columns once
+	redirectGraph();
+	qDebug() << "...Done.";
+}
+
+QByteArray
+Database::compressText(const QString& wikiText)
+{
+	return qCompress(wikiText.toUtf8());
 }
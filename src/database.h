@@ -5,34 +5,131 @@
 #define DATABASE_H
 
 #include <QObject>
-#include <QSqlQueryModel>
 #include <QSqlDatabase>
-#include <QJsonArray>
+#include <QSqlQuery>
+#include <QHash>
+#include <QFuture>
+#include "pagetablemodel.h"
+#include "queryresults.h"
+#include "redirectgraph.h"
+#include "syncmetrics.h"
+#include "wikilinks.h"
+#include "wikipage.h"
+#include <functional>
 
 class Database : public QObject
 {
 	Q_OBJECT
 
 public:
-	Database(QObject* parent = nullptr);
-	~Database() { _db.close(); }
+	// An empty connectionName means Qt's default connection
+	Database(const QString& filePath, const QString& connectionName = QString(), QObject* parent = nullptr);
+	~Database();
+
+	void setMetrics(SyncMetrics* metrics)
+	{ _metrics = metrics; }
 
 	QVector<int> allPageIds() const;
 	int idOf(const QString& title) const;
 	QString lastModified(int pageId) const;
-	void exportWikiText(const QString& exportDir) const;
-	void updateDatabase(const QJsonArray& wikiData);
+	QHash<int, QString> allTimestamps() const;
+	void exportWikiText(const QString& exportDir);
+	void updateDatabase(const QVector<WikiPage>& pages);
+	void finalizeUpdate(bool interrupted = false);
 	void deletePages(const QVector<int>& pageIds);
 
+	QString syncState(const QString& key) const;
+	void setSyncState(const QString& key, const QString& value);
+
+	// How the wiki writes redirects and links (see WikiQuerier::siteInfoFetched()).
+	// Kept for later runs. If it changes, the next scan extracts everything again.
+	void setSiteInfo(const QJsonObject& siteInfo);
+
+	// Progress of an interrupted refresh.
+	// ListedPages = Pages found online so far; PendingPages = Pages still to be downloaded
+	void checkpointListing(const QVector<int>& listedIds, const QVector<int>& changedIds, const QString& resumePoint);
+	QString listingResumePoint() const;
+	QVector<int> listedPages() const;
+	void addPendingPages(const QVector<int>& pageIds);
+	QVector<int> pendingPages() const;
+	void clearCheckpoint();
+
+	QVector<SearchHit> search(const QString& query, int limit = 50) const;
+
+	// Where a page leads to after following all redirects (the page itself if it isn't a redirect).
+	// -1 if the redirect is broken or loops.
+	int finalTargetOf(int pageId) const;
+	QVector<int> redirectsWithStatus(RedirectGraph::Status status) const;
+
+	// Answered from the Links table. Pages downloaded before it existed only show up after a rescan
+	// (which the next refresh runs, see extractionIsOutdated()).
+	QVector<int> backlinks(int pageId) const;  // Pages that link to pageId
+	QVector<int> orphanPages() const;           // Pages (other than redirects) that nothing links to
+	QVector<WantedPage> danglingLinks(int limit = 100) const; // Missing pages, most linked-to first
+
 	void deepScanForRedirects();
-	QAbstractTableModel* dbModel() const {return _model;}
+
+	// True if the redirect targets and links were extracted by an older WikiLinks,
+	// or with another siteinfo, until deepScanForRedirects() extracts them again
+	bool extractionIsOutdated() const;
+	PageTableModel* dbModel() const {return _model;}
+
+signals:
+	void redirectScanProgress(int scannedPages, int totalPages) const;
+	void redirectScanFinished(bool success) const;
+	void exportFinished(bool success) const;
 
 private:
-	void updateModel();
-	QString extractRedirection(const QString& wikiText) const;
+	struct ExportFile
+	{
+		QString path;
+		QByteArray compressedText;
+	};
+
+	bool hasPages() const;
+	QVector<int> idsIn(const QString& table) const;
+	RedirectGraph& redirectGraph();
+	void forgetRedirectGraph() { _redirectGraph.clear(); _redirectGraphLoaded = false; }
+	bool storeResolutions(const QHash<int, RedirectGraph::Resolution>& resolutions);
+	void reportRedirects();
+
+	void moveTextOutOfPages();
+	void addRedirectColumns();
+	void createSearchIndex();
+	bool indexPages(const QVariantList& ids, const QVariantList& titles, const QVariantList& texts);
+	bool unindexPages(const QVector<int>& pageIds);
+	static QString makeSnippet(const QString& wikiText, const QStringList& terms);
+
+	QFuture<bool> runOnOwnConnection(const QString& connectionName, const std::function<bool(QSqlDatabase&)>& job) const;
+	bool exportChangedPages(QSqlDatabase& exportDb, const QString& exportPath) const;
+	static bool writeExportFile(const ExportFile& exportFile);
+	bool scanForRedirects(QSqlDatabase& scanDb, const WikiLinks& wikiLinks, QVector<int>& changedIds) const;
+	bool storeLinks(QSqlDatabase& db, const QVariantList& ids, const QVector<QStringList>& links,
+			const QVariantList& titles, const QVariantList& timestamps) const;
+	static QByteArray compressText(const QString& wikiText);
 
 	QSqlDatabase _db;
-	QSqlQueryModel* _model;
+	PageTableModel* _model;
+	SyncMetrics* _metrics;
+
+	// Prepared once, reused for every batch
+	QSqlQuery _upsertQuery;
+	QSqlQuery _contentQuery;
+
+	QFuture<bool> _scanJob;
+	QFuture<bool> _exportJob;
+
+	// Mirrors the titles and redirect targets in Pages. Built on demand with
+	// one pass over the table, then kept up to date batch by batch.
+	// NOTE: The redirection, finalTarget and redirectStatus columns are derived from it.
+	RedirectGraph _redirectGraph;
+	bool _redirectGraphLoaded;
+
+	// Copied into the workers, which may run while it is replaced
+	WikiLinks _wikiLinks;
+
+	// False if the SQLite build has no FTS5
+	bool _searchAvailable;
 };
 
 #endif // DATABASE_H
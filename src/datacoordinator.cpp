@@ -3,85 +3,415 @@
 
 #include "datacoordinator.h"
 
+#include <QDateTime>
+
+// The recent changes feed is pruned after $wgRCMaxAge (90 days by default).
+// Fall back to a full crawl well before then.
+static const int maxIncrementalAgeDays = 30;
+
+// Timestamp of the latest wiki edit that is in the database. Where the next recent changes query starts.
+static const QString lastSyncKey = "lastSync";
+
+// Local (UTC) time of the last refresh that completed. A quiet wiki doesn't move lastSync.
+static const QString lastRefreshKey = "lastRefresh";
+
+// Namespaces that the database holds all the pages of, as a comma-separated list of IDs.
+// When the set changes, only a full crawl can fetch (or prune) the pages in question.
+static const QString namespacesKey = "namespaces";
+
+// Progress of the current refresh, so that it can be resumed after an interruption.
+// The page IDs themselves are kept in the database (see Database::checkpointListing()).
+static const QString refreshPhaseKey = "refreshPhase";
+static const QString refreshSyncPointKey = "refreshSyncPoint";
+static const QString refreshNamespacesKey = "refreshNamespaces";
+static const QString listingPhase = "listing";
+static const QString downloadPhase = "download";
+
+static const QString defaultDatabaseFile = "data.db";
+static const QString defaultMetricsFile = "metrics.json";
+
 /**********************************************************************\
  * CONSTRUCTOR/DESTRUCTOR
 \**********************************************************************/
-DataCoordinator::DataCoordinator(QObject* parent) :
+DataCoordinator::DataCoordinator(const WikiSite& site, QObject* parent) :
 	QObject(parent),
-	db(new Database(this)),
-	wq(new WikiQuerier(this))
+	site(site),
+	db(new Database(site.databaseFile.isEmpty() ? defaultDatabaseFile : site.databaseFile, site.name, this)),
+	wq(new WikiQuerier(this)),
+	metricsFile(site.name.isEmpty() ? defaultMetricsFile : QString("metrics-%1.json").arg(site.name)),
+	refreshSucceeded(false),
+	fullCrawlRequested(false),
+	scanningAfterRefresh(false)
 {
-	connect(wq, &WikiQuerier::pageListFetched, [=](const QVector<int>& onlineIds)
+	if (!site.apiUrl.isEmpty())
+		wq->setApiUrl(site.apiUrl);
+	wq->setIncludedNamespaces(site.namespaces);
+	db->setMetrics(&metrics);
+	wq->setMetrics(&metrics);
+
+	connect(wq, &WikiQuerier::siteInfoFetched,
+			db, &Database::setSiteInfo);
+	connect(wq, &WikiQuerier::namespacesFetched,
+			this, &DataCoordinator::startRefresh);
+	connect(wq, &WikiQuerier::latestChangeFetched, [=](const QString& timestamp)
 	{
-		// Don't delete anything if the list is incomplete
+		metrics.endPhase("latest_change");
+		pendingSyncPoint = timestamp;
+		localTimestamps = db->allTimestamps();
+
+		// From here on, an interrupted refresh can be resumed
+		db->clearCheckpoint();
+		db->setSyncState(refreshSyncPointKey, pendingSyncPoint);
+		db->setSyncState(refreshNamespacesKey, pendingNamespaces);
+		db->setSyncState(refreshPhaseKey, listingPhase);
+
+		qDebug() << "(1) Fetching list of pages and their timestamps...";
+		metrics.beginPhase("listing");
+		wq->queryPageList();
+	});
+	connect(wq, &WikiQuerier::recentChangesFetched, [=](const QVector<int>& changedIds, const QStringList& deletedTitles, const QString& latestTimestamp)
+	{
+		metrics.endPhase("recent_changes");
+
+		// Nothing must be skipped, or the sync point would move past it
 		if (!wq->lastOperationWasCompleted())
 		{
-			qDebug() << "(2) Skipping check for deleted pages.\n";
-			qDebug() << "(3) Skipping deletion from database.\n";
+			refreshSucceeded = false;
+			qDebug() << "...Incomplete list of changes. Try again later.\n";
+			finishRefresh();
+			return;
+		}
+		pendingSyncPoint = latestTimestamp;
+		qDebug() << "...Found" << changedIds.count() << "changed pages and" << deletedTitles.count() << "deletions.\n";
+
+		// A deleted title may have been re-created as a new page, or restored under the same ID
+		QVector<int> removedIds;
+		for (const QString& title : deletedTitles)
+		{
+			int id = db->idOf(title);
+			if (id != -1 && !changedIds.contains(id))
+				removedIds << id;
+		}
+		if (!removedIds.isEmpty())
+		{
+			qDebug() << "(2) Deleting" << removedIds.count() << "pages from database...";
+			metrics.beginPhase("deletion");
+			db->deletePages(removedIds);
+			metrics.endPhase("deletion");
+			metrics.add("pages_deleted", removedIds.count());
+			qDebug() << "...Done.\n";
+		}
+
+		db->clearCheckpoint();
+		db->addPendingPages(changedIds);
+		db->setSyncState(refreshSyncPointKey, pendingSyncPoint);
+		db->setSyncState(refreshPhaseKey, downloadPhase);
+
+		qDebug() << "(3) Downloading changed pages...";
+		downloadPendingPages();
+	});
+	connect(wq, &WikiQuerier::pageInfoChunkFetched, [=](const QMap<int, QString>& onlineTimestamps, const QString& resumePoint)
+	{
+		// Diff each chunk as soon as it arrives
+		QVector<int> listedIds;
+		QVector<int> updatedIds;
+		for (auto it = onlineTimestamps.constBegin(); it != onlineTimestamps.constEnd(); ++it)
+		{
+			listedIds << it.key();
+
+			// Pages that aren't stored locally yet compare against an empty string
+			if (localTimestamps.value(it.key()) != it.value())
+				updatedIds << it.key();
+		}
+		db->checkpointListing(listedIds, updatedIds, resumePoint);
+	});
+	connect(wq, &WikiQuerier::pageListFetched, [=]
+	{
+		metrics.endPhase("listing");
+		localTimestamps.clear();
+
+		// Don't delete anything if the list is incomplete. The next refresh resumes the listing.
+		if (!wq->lastOperationWasCompleted())
+		{
+			refreshSucceeded = false;
+			qDebug() << "...Incomplete list of pages. Try again later.\n";
+			finishRefresh();
 			return;
 		}
 
 		qDebug() << "(2) Checking for deleted pages...";
+		metrics.beginPhase("deletion");
 
+		// NOTE: The listing might have been spread over several runs
 		auto localIds = db->allPageIds().toList().toSet();
-		auto removedIds = localIds - onlineIds.toList().toSet();
+		auto removedIds = localIds - db->listedPages().toList().toSet();
 		if (removedIds.isEmpty())
 		{
 			qDebug() << "...No pages deleted.\n";
 			qDebug() << "(3) Skipping deletion from database.\n";
-			return;
 		}
-		qDebug() << "...Found" << removedIds.count() << "deleted pages.\n";
+		else
+		{
+			qDebug() << "...Found" << removedIds.count() << "deleted pages.\n";
+
+			qDebug() << "(3) Deleting pages from database...";
+			db->deletePages(removedIds.toList().toVector());
+			metrics.add("pages_deleted", removedIds.count());
+			qDebug() << "...Done.\n";
+		}
+		metrics.endPhase("deletion");
+
+		db->setSyncState(refreshPhaseKey, downloadPhase);
 
-		qDebug() << "(3) Deleting pages from database...";
-		db->deletePages(removedIds.toList().toVector());
-		qDebug() << "...Done.\n";
+		qDebug() << "(4) Downloading updated pages...";
+		downloadPendingPages();
 	});
-	connect(wq, &WikiQuerier::pageListFetched,
-			wq, &WikiQuerier::queryLastModified);
-	connect(wq, &WikiQuerier::timestampsFetched, [=](QMap<int,QString> stamps)
+	connect(wq, &WikiQuerier::wikiTextChunkFetched,
+			db, &Database::updateDatabase);
+	connect(wq, &WikiQuerier::wikiTextFetched, [=]
 	{
-		qDebug() << "(5) Checking for updates...";
-		auto onlineIds =  stamps.keys();
+		metrics.endPhase("download");
 
-		QVector<int> updatedIds;
-		for (int id : onlineIds)
-		{
-			auto timestamp = db->lastModified(id);
-			if (timestamp != stamps[id])
-				updatedIds << id;
-		}
+		bool completed = wq->lastOperationWasCompleted();
+		metrics.beginPhase("finalize");
+		db->finalizeUpdate(!completed);
+		metrics.endPhase("finalize");
 
-		if (updatedIds.isEmpty())
-		{
-			qDebug() << "...No updates found.\n";
-			qDebug() << "Database refresh completed.\n";
-			emit currentJobFinished();
-		}
+		// Pages that failed stay pending for the next refresh
+		if (!completed)
+			refreshSucceeded = false;
 		else
 		{
-			qDebug() << "...Found" << updatedIds.count() << "updates.\n";
-			wq->downloadPages(updatedIds);
+			db->clearCheckpoint();
+			db->setSyncState(refreshPhaseKey, QString());
 		}
+		finishRefresh();
 	});
-	connect(wq, &WikiQuerier::wikiTextFetched, [=](const QJsonArray& wikiText)
+
+	connect(db, &Database::redirectScanProgress, [=](int scannedPages, int totalPages)
 	{
-		db->updateDatabase(wikiText);
-		emit currentJobFinished();
+		qDebug() << "\t" << scannedPages << "/" << totalPages << "pages scanned";
+	});
+	connect(db, &Database::redirectScanFinished, [=](bool success)
+	{
+		if (!scanningAfterRefresh)
+		{
+			finishJob(success);
+			return;
+		}
+		scanningAfterRefresh = false;
+		metrics.endPhase("rescan");
+		finishJob(refreshSucceeded && success);
 	});
+	connect(db, &Database::exportFinished,
+			this, &DataCoordinator::finishJob);
 }
 
 /**********************************************************************\
  * PUBLIC
 \**********************************************************************/
 void
-DataCoordinator::refreshDatabase()
+DataCoordinator::refreshDatabase(bool fullCrawl)
+{
+	refreshSucceeded = true;
+	pendingSyncPoint.clear();
+	pendingNamespaces.clear();
+	wq->networkTransport()->resetStats();
+
+	// Carry on with an interrupted refresh, unless a fresh full crawl was asked for
+	QString phase = db->syncState(refreshPhaseKey);
+	if (!phase.isEmpty())
+	{
+		if (fullCrawl)
+			db->setSyncState(refreshPhaseKey, QString());
+		else
+		{
+			metrics.beginJob("refresh_resumed");
+			resumeRefresh(phase);
+			return;
+		}
+	}
+
+	// Whether an incremental refresh will do depends on the namespaces. See startRefresh().
+	fullCrawlRequested = fullCrawl;
+	wq->queryNamespaces();
+}
+
+void
+DataCoordinator::forceRederiveData()
+{
+	metrics.beginJob("redirect_scan");
+	db->deepScanForRedirects();
+}
+
+void
+DataCoordinator::exportData(const QString& exportDir)
+{
+	metrics.beginJob("export");
+	db->exportWikiText(exportDir);
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+void
+DataCoordinator::startRefresh(bool namespacesKnown)
 {
-	// This sets off an event-driven chain (see constructor):
-	// 1. queryPageList()
-	// 2. queryLastModified()
-	// 3. downloadPages()
-	qDebug() << "== Refreshing database ==";
-	qDebug() << "(1) Fetching list of pages...";
-	wq->queryPageList();
+	if (!namespacesKnown)
+	{
+		qDebug() << "ERROR: DataCoordinator: Cannot refresh" << qPrintable(databaseLabel()) << "without its namespaces";
+		metrics.beginJob("refresh_full");
+		refreshSucceeded = false;
+		finishRefresh();
+		return;
+	}
+
+	QStringList namespaceIds;
+	for (int namespaceId : wq->namespaces())
+		namespaceIds << QString::number(namespaceId);
+	QString namespaces = namespaceIds.join(',');
+
+	QString lastSync = db->syncState(lastSyncKey);
+	QString lastRefresh = db->syncState(lastRefreshKey);
+
+	// Databases from before lastRefresh was recorded only have lastSync to go by
+	if (lastRefresh.isEmpty())
+		lastRefresh = lastSync;
+
+	// Pages of newly mirrored namespaces haven't necessarily changed lately, and
+	// those of dropped namespaces would never be deleted
+	bool namespacesChanged = db->syncState(namespacesKey) != namespaces;
+	if (namespacesChanged && !lastSync.isEmpty())
+		qDebug() << "The mirrored namespaces of" << qPrintable(databaseLabel()) << "have changed to" << namespaces;
+
+	// Incremental refresh (see constructor):
+	// 1. queryRecentChanges(). Changed pages are noted as pending.
+	// 2. downloadPages() for the pending pages
+	auto lastRefreshTime = QDateTime::fromString(lastRefresh, Qt::ISODate);
+	if (!fullCrawlRequested && !namespacesChanged && !lastSync.isEmpty() && lastRefreshTime.isValid()
+			&& lastRefreshTime.daysTo(QDateTime::currentDateTimeUtc()) < maxIncrementalAgeDays)
+	{
+		qDebug() << "== Refreshing" << qPrintable(databaseLabel()) << "(changes since" << lastSync << ") ==";
+		qDebug() << "(1) Fetching recent changes...";
+		db->setSyncState(refreshNamespacesKey, QString());
+		metrics.beginJob("refresh_incremental");
+		metrics.beginPhase("recent_changes");
+		wq->queryRecentChanges(lastSync);
+		return;
+	}
+
+	// Full refresh. This sets off an event-driven chain (see constructor):
+	// 0. queryLatestChange()
+	// 1. queryPageList(), which also brings the timestamps. Changed pages are noted as pending.
+	// 2. downloadPages() for the pending pages
+	// The namespaces are recorded once it completes.
+	pendingNamespaces = namespaces;
+	qDebug() << "== Refreshing" << qPrintable(databaseLabel()) << "==";
+	qDebug() << "(0) Noting the latest change...";
+	metrics.beginJob("refresh_full");
+	metrics.beginPhase("latest_change");
+	wq->queryLatestChange();
+}
+
+void
+DataCoordinator::resumeRefresh(const QString& phase)
+{
+	pendingSyncPoint = db->syncState(refreshSyncPointKey);
+	pendingNamespaces = db->syncState(refreshNamespacesKey);
+	qDebug() << "== Resuming interrupted refresh of" << qPrintable(databaseLabel()) << "(up to" << pendingSyncPoint << ") ==";
+
+	if (phase == listingPhase)
+	{
+		localTimestamps = db->allTimestamps();
+
+		qDebug() << "(1) Fetching the rest of the list of pages...";
+		metrics.beginPhase("listing");
+		wq->queryPageList(db->listingResumePoint());
+	}
+	else
+	{
+		qDebug() << "(4) Downloading the remaining pages...";
+		downloadPendingPages();
+	}
+}
+
+void
+DataCoordinator::downloadPendingPages()
+{
+	auto pageIds = db->pendingPages();
+	if (pageIds.isEmpty())
+	{
+		qDebug() << "...No pages to download.\n";
+		db->setSyncState(refreshPhaseKey, QString());
+		qDebug() << "Database refresh completed.\n";
+		finishRefresh();
+		return;
+	}
+
+	qDebug() << "...Found" << pageIds.count() << "pages to download.\n";
+	metrics.beginPhase("download");
+	wq->downloadPages(pageIds);
+}
+
+void
+DataCoordinator::finishRefresh()
+{
+	// Only move the sync point forward once everything up to it is in the database
+	if (refreshSucceeded && !pendingSyncPoint.isEmpty())
+		db->setSyncState(lastSyncKey, pendingSyncPoint);
+	if (refreshSucceeded && !pendingNamespaces.isEmpty())
+		db->setSyncState(namespacesKey, pendingNamespaces);
+	if (refreshSucceeded)
+		db->setSyncState(lastRefreshKey, QDateTime::currentDateTimeUtc().toString(Qt::ISODate));
+
+	logTraffic();
+
+	auto transport = wq->networkTransport();
+	metrics.add("requests", transport->requestCount());
+	metrics.add("http2_requests", transport->http2RequestCount());
+	metrics.add("request_retries", transport->retryCount());
+	metrics.add("wire_bytes", transport->wireBytes());
+	metrics.add("decoded_bytes", transport->decodedBytes());
+
+	qint64 downloadMs = metrics.phaseMilliseconds("download");
+	if (downloadMs > 0)
+		metrics.setGauge("pages_per_second", metrics.counter("pages_stored") * 1000.0 / downloadMs);
+
+	// After an upgrade (or a change in the wiki's syntax), the redirect targets and links
+	// of the pages that weren't downloaded again are out of date. The job ends with the scan.
+	if (refreshSucceeded && db->extractionIsOutdated())
+	{
+		qDebug() << "== Extracting the redirects and links of" << qPrintable(databaseLabel()) << "again ==";
+		scanningAfterRefresh = true;
+		metrics.beginPhase("rescan");
+		db->deepScanForRedirects();
+		return;
+	}
+
+	finishJob(refreshSucceeded);
+}
+
+void
+DataCoordinator::finishJob(bool success)
+{
+	metrics.endJob(success);
+	if (!metricsFile.isEmpty())
+		metrics.writeTo(metricsFile);
+
+	emit currentJobFinished(success);
+}
+
+void
+DataCoordinator::logTraffic() const
+{
+	auto transport = wq->networkTransport();
+	if (transport->requestCount() == 0)
+		return;
+
+	qint64 wireKiB = transport->wireBytes() / 1024;
+	qint64 decodedKiB = transport->decodedBytes() / 1024;
+	qDebug() << "Network:" << transport->requestCount() << "requests,"
+			<< transport->http2RequestCount() << "over HTTP/2," << transport->retryCount() << "retried";
+	qDebug() << "\t" << wireKiB << "KiB on the wire," << decodedKiB << "KiB decoded"
+			<< qPrintable(QString("(%1% saved)").arg(decodedKiB > 0 ? 100 - 100 * wireKiB / decodedKiB : 0));
 }
@@ -6,7 +6,9 @@
 
 #include <QObject>
 #include "database.h"
+#include "syncmetrics.h"
 #include "wikiquerier.h"
+#include "wikisite.h"
 
 #include <QDebug>
 
@@ -15,33 +17,77 @@ class DataCoordinator : public QObject
 	Q_OBJECT
 
 signals:
-	void currentJobFinished() const;
+	void currentJobFinished(bool success) const;
 
 public:
-	explicit DataCoordinator(QObject* parent = nullptr);
+	explicit DataCoordinator(const WikiSite& site = WikiSite(), QObject* parent = nullptr);
+
+	QString wikiName() const
+	{ return site.name; }
 
 	void setNetworkAccessManager(QNetworkAccessManager* nam)
 	{ wq->setNetworkAccessManager(nam); }
 
-	void refreshDatabase();
-	void forceRederiveData()
-	{
-		db->deepScanForRedirects();
-		emit currentJobFinished();
-	}
+	void setApiUrl(const QUrl& url)
+	{ wq->setApiUrl(url); }
+
+	void setMaxConcurrentRequests(int count)
+	{ wq->setMaxConcurrentRequests(count); }
+
+	void setRequestBudget(RequestBudget* budget)
+	{ wq->networkTransport()->setRequestBudget(budget); }
+
+	// Where the metrics of each job are written (see SyncMetrics::writeTo()). Empty = Not written.
+	void setMetricsFile(const QString& filePath)
+	{ metricsFile = filePath; }
 
-	void exportData(const QString& exportDir)
-	{
-		db->exportWikiText(exportDir);
-		emit currentJobFinished();
-	}
+	// Only fetches the recent changes, unless fullCrawl is set or the last sync was too long ago.
+	// An interrupted refresh is resumed where it stopped, unless fullCrawl is set.
+	void refreshDatabase(bool fullCrawl = false);
+	void forceRederiveData();
+	void exportData(const QString& exportDir);
 
-	QAbstractTableModel* dbModel() const
+	QVector<SearchHit> search(const QString& query) const
+	{ return db->search(query); }
+
+	PageTableModel* dbModel() const
 	{ return db->dbModel(); }
 
 private:
+	// For the log, where several wikis may be refreshing at once
+	QString databaseLabel() const
+	{ return site.name.isEmpty() ? "database" : "wiki " + site.name; }
+
+	void startRefresh(bool namespacesKnown);
+	void resumeRefresh(const QString& phase);
+	void downloadPendingPages();
+	void finishRefresh();
+	void finishJob(bool success);
+	void logTraffic() const;
+
+	WikiSite site;
 	Database* db;
 	WikiQuerier* wq;
+
+	SyncMetrics metrics;
+	QString metricsFile;
+
+	// Cleared by any step of a refresh that doesn't complete
+	bool refreshSucceeded;
+
+	// Point in the wiki's history that the current refresh brings the database up to
+	QString pendingSyncPoint;
+
+	// Namespaces that the current full crawl lists. Empty for incremental refreshes.
+	QString pendingNamespaces;
+
+	bool fullCrawlRequested;
+
+	// Set while a refresh finishes with a scan (see finishRefresh())
+	bool scanningAfterRefresh;
+
+	// Timestamps in the database while the pages are being listed
+	QHash<int, QString> localTimestamps;
 };
 
 #endif // DATACOORDINATOR_H
@@ -3,9 +3,13 @@
 
 #include "databaseui.h"
 #include "ui_databaseui.h"
+#include "logsink.h"
+#include "pagetablemodel.h"
 #include <QFileDialog>
-#include <QAbstractTableModel>
-#include <QSortFilterProxyModel>
+#include <QTimer>
+
+// Messages are shown in batches, instead of re-laying out the view for each one
+static const int logFlushIntervalMs = 100;
 
 /**********************************************************************\
  * CONSTRUCTOR/DESTRUCTOR
@@ -13,15 +17,29 @@
 DatabaseUI::DatabaseUI(QWidget* parent) :
 	QWidget(parent),
 	ui(new Ui::DatabaseUI),
-	modelFilter(new QSortFilterProxyModel(this))
+	dbModel(nullptr),
+	logSink(nullptr),
+	logTimer(new QTimer(this))
 {
 	ui->setupUi(this);
-	ui->table_dbView->setModel(modelFilter);
+	ui->table_searchResults->hide();
+	ui->comboBox_wiki->hide();
+	ui->button_refreshAll->hide();
 
-	modelFilter->setFilterKeyColumn(3);
 	connect(ui->lineEdit_titleFilter, &QLineEdit::textChanged, [=](const QString& text)
 	{
-		modelFilter->setFilterRegExp(text);
+		if (dbModel)
+			dbModel->setTitleFilter(text);
+	});
+	connect(ui->lineEdit_contentSearch, &QLineEdit::returnPressed, [=]
+	{
+		QString query = ui->lineEdit_contentSearch->text().trimmed();
+		if (query.isEmpty())
+		{
+			ui->table_searchResults->hide();
+			return;
+		}
+		emit searchRequested(query);
 	});
 	connect(ui->button_exportData, &QPushButton::clicked, [=]
 	{
@@ -31,8 +49,16 @@ DatabaseUI::DatabaseUI(QWidget* parent) :
 		emit exportRequested(exportDir);
 	});
 
+	logTimer->setInterval(logFlushIntervalMs);
+	connect(logTimer, &QTimer::timeout,
+			this, &DatabaseUI::flushLog);
+
+	connect(ui->comboBox_wiki, &QComboBox::currentTextChanged,
+			this, &DatabaseUI::wikiSelected);
 	connect(ui->button_refreshDb, &QPushButton::clicked,
 			this, &DatabaseUI::refreshDbRequested);
+	connect(ui->button_refreshAll, &QPushButton::clicked,
+			this, &DatabaseUI::refreshAllRequested);
 	connect(ui->button_forceScanForRedirections, &QPushButton::clicked,
 			this, &DatabaseUI::forceRederiveRequested);
 }
@@ -46,15 +72,69 @@ DatabaseUI::~DatabaseUI()
  * PUBLIC
 \**********************************************************************/
 void
-DatabaseUI::setDbModel(QAbstractTableModel* model)
+DatabaseUI::setWikiNames(const QStringList& names)
+{
+	ui->comboBox_wiki->clear();
+	ui->comboBox_wiki->addItems(names);
+
+	bool several = names.count() > 1;
+	ui->comboBox_wiki->setVisible(several);
+	ui->button_refreshAll->setVisible(several);
+}
+
+void
+DatabaseUI::setDbModel(PageTableModel* model)
+{
+	// Another wiki's pages, shown the same way
+	if (dbModel && model)
+		model->sort(dbModel->sortColumn(), dbModel->sortOrder());
+	if (model)
+		model->setTitleFilter(ui->lineEdit_titleFilter->text());
+
+	dbModel = model;
+	ui->table_dbView->setModel(model);
+	ui->table_searchResults->hide();
+}
+
+void
+DatabaseUI::setLogSink(LogSink* sink)
 {
-	modelFilter->setSourceModel(model);
+	logSink = sink;
+	if (logSink)
+		logTimer->start();
+	else
+		logTimer->stop();
 }
 
 void
-DatabaseUI::writeLog(const QString &message)
+DatabaseUI::showSearchResults(const QVector<SearchHit>& hits)
 {
-	ui->textEdit_log->append(message);
+	auto table = ui->table_searchResults;
+	table->setRowCount(hits.count());
+	for (int row = 0; row < hits.count(); ++row)
+	{
+		auto idItem = new QTableWidgetItem;
+		idItem->setData(Qt::DisplayRole, hits[row].pageId);
+		table->setItem(row, 0, idItem);
+		table->setItem(row, 1, new QTableWidgetItem(hits[row].title));
+		table->setItem(row, 2, new QTableWidgetItem(hits[row].snippet));
+	}
+	table->show();
+}
+
+void
+DatabaseUI::flushLog()
+{
+	auto entries = logSink->drain();
+	if (entries.isEmpty())
+		return;
+
+	QStringList lines;
+	for (const LogEntry& entry : entries)
+		lines << entry.message;
+
+	// NOTE: The view only keeps the latest lines (see maximumBlockCount in the .ui file)
+	ui->plainTextEdit_log->appendPlainText(lines.join('\n'));
 }
 
 /**********************************************************************\
@@ -63,7 +143,9 @@ DatabaseUI::writeLog(const QString &message)
 void
 DatabaseUI::setButtonsEnabled(bool enabled)
 {
+	ui->comboBox_wiki->setEnabled(enabled);
 	ui->button_refreshDb->setEnabled(enabled);
+	ui->button_refreshAll->setEnabled(enabled);
 	ui->button_forceScanForRedirections->setEnabled(enabled);
 	ui->button_exportData->setEnabled(enabled);
 }
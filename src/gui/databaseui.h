@@ -4,9 +4,12 @@
 #ifndef DATABASEUI_H
 #define DATABASEUI_H
 
+#include <QVector>
 #include <QWidget>
-class QAbstractTableModel;
-class QSortFilterProxyModel;
+#include "queryresults.h"
+class QTimer;
+class LogSink;
+class PageTableModel;
 
 
 namespace Ui {
@@ -18,16 +21,25 @@ class DatabaseUI : public QWidget
 	Q_OBJECT
 
 signals:
+	void wikiSelected(const QString& name) const;
 	void refreshDbRequested() const;
+	void refreshAllRequested() const;
 	void forceRederiveRequested() const;
 	void exportRequested(const QString& exportDir) const;
+	void searchRequested(const QString& query) const;
 
 public:
 	explicit DatabaseUI(QWidget* parent = nullptr);
 	~DatabaseUI();
 
-	void setDbModel(QAbstractTableModel* model);
-	void writeLog(const QString& message);
+	// The wiki selector and "all wikis" button only show up when there is more than one
+	void setWikiNames(const QStringList& names);
+	void setDbModel(PageTableModel* model);
+
+	// The log view shows what was posted to the sink, a batch at a time
+	void setLogSink(LogSink* sink);
+	void flushLog();
+	void showSearchResults(const QVector<SearchHit>& hits);
 
 public slots:
 	void setButtonsEnabled(bool enabled = true);
@@ -35,7 +47,11 @@ public slots:
 private:
 	Ui::DatabaseUI *ui;
 
-	QSortFilterProxyModel* modelFilter;
+	// Sorts and filters the rows itself (see PageTableModel)
+	PageTableModel* dbModel;
+
+	LogSink* logSink;
+	QTimer* logTimer;
 };
 
 #endif // DATABASEUI_H
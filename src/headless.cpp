@@ -0,0 +1,204 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "headless.h"
+#include "logsink.h"
+#include "wikiregistry.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QNetworkAccessManager>
+#include <QTimer>
+
+#include <cstdio>
+
+#include <QDebug>
+
+// Exit codes
+enum
+{
+	ExitSuccess = 0,
+	ExitJobFailed = 1,
+	ExitUsageError = 2
+};
+
+static const QStringList commands{"refresh", "rescan", "export"};
+
+// List of mirrored wikis, in the data folder (see WikiRegistry)
+static const QString wikiListFile = "wikis.json";
+
+static const QStringList logLevels{"debug", "info", "warning", "critical"};
+
+static const QCommandLineOption wikiOption("wiki",
+		"Wiki to work on, as named in " + wikiListFile + ". Can be given more than once. "
+		"Default: The first one listed.", "name");
+static const QCommandLineOption allOption("all",
+		"Work on all the wikis in " + wikiListFile + " at once.");
+static const QCommandLineOption concurrencyOption("concurrency",
+		"Maximum number of requests in flight per wiki (refresh only).", "count");
+static const QCommandLineOption maxRequestsOption("max-requests",
+		"Maximum number of requests in flight over all wikis (refresh only).", "count");
+static const QCommandLineOption apiOption("api",
+		"URL of the wiki's api.php (refresh of a single wiki only).", "url");
+static const QCommandLineOption metricsOption("metrics",
+		"Write the job's metrics to this file: Prometheus text if it ends in .prom, JSON otherwise "
+		"(single wiki only).", "file");
+static const QCommandLineOption logFileOption("log-file",
+		"Also write the log to this file. It is rotated when it reaches 10 MiB.", "file");
+static const QCommandLineOption logLevelOption("log-level",
+		"Least severe messages to show: " + logLevels.join(", ") + ".", "level", "debug");
+static const QCommandLineOption fullOption("full",
+		"Crawl the whole wiki instead of only fetching the recent changes (refresh only).");
+
+// The log is written out in batches
+static const int logFlushIntervalMs = 100;
+
+static LogSink* logSink = nullptr;
+
+static void
+flushLog()
+{
+	for (const LogEntry& entry : logSink->drain())
+		std::fprintf(stdout, "%s\n", entry.message.toUtf8().constData());
+	std::fflush(stdout);
+}
+
+static void
+sinkLog(QtMsgType type, const QMessageLogContext&, const QString& msg)
+{
+	// Written out every logFlushIntervalMs, or sooner during a burst
+	logSink->postFromHandler(type, msg, flushLog);
+
+	if (type == QtFatalMsg)
+	{
+		std::fprintf(stderr, "%s\n", msg.toUtf8().constData());
+		abort();
+	}
+}
+
+static void
+setUpParser(QCommandLineParser& parser)
+{
+	parser.setApplicationDescription("Runs a single Wique job without a GUI.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("command", "One of: " + commands.join(", "));
+	parser.addPositionalArgument("dir", "Folder to export into (export only).", "[dir]");
+	parser.addOptions({wikiOption, allOption, concurrencyOption, maxRequestsOption, apiOption,
+			metricsOption, logFileOption, logLevelOption, fullOption});
+}
+
+bool
+isHeadlessRun(int argc, char* argv[])
+{
+	QStringList arguments;
+	for (int i = 0; i < argc; ++i)
+		arguments << QString::fromLocal8Bit(argv[i]);
+
+	// The command may come after the options (e.g. "Wique --wiki foo refresh"), so they have to be
+	// parsed to find it. Unknown options (e.g. Qt's own "-style") are left for later.
+	// NOTE: Read as long options, "-stylesheet" can't be mistaken for "-s -t -y -l -e -s -h ..."
+	QCommandLineParser parser;
+	setUpParser(parser);
+	parser.setSingleDashWordOptionMode(QCommandLineParser::ParseAsLongOptions);
+	parser.parse(arguments);
+	return parser.isSet("help") || commands.contains(parser.positionalArguments().value(0));
+}
+
+int
+runHeadless(const QStringList& arguments, const QString& callerPath)
+{
+	QCommandLineParser parser;
+	setUpParser(parser);
+	parser.process(arguments); // Exits on --help or unknown options
+
+	QStringList args = parser.positionalArguments();
+	QString command = args.value(0);
+	if (!commands.contains(command) || (command == "export") != (args.count() == 2) || args.count() > 2
+			|| !logLevels.contains(parser.value(logLevelOption)))
+	{
+		std::fprintf(stderr, "%s\n", parser.helpText().toUtf8().constData());
+		return ExitUsageError;
+	}
+
+	// The current folder is the data folder by now (see main())
+	QDir callerDir(callerPath);
+	QString logFile = parser.isSet(logFileOption) ? callerDir.absoluteFilePath(parser.value(logFileOption)) : QString();
+	QString metricsFile = parser.isSet(metricsOption) ? callerDir.absoluteFilePath(parser.value(metricsOption)) : QString();
+	QString exportDir = command == "export" ? callerDir.absoluteFilePath(args[1]) : QString();
+
+	LogSink sink;
+	sink.setMinimumLevel(static_cast<LogLevel>(logLevels.indexOf(parser.value(logLevelOption))));
+	if (!logFile.isEmpty() && !sink.setLogFile(logFile))
+	{
+		std::fprintf(stderr, "Cannot open log file %s\n", logFile.toUtf8().constData());
+		return ExitUsageError;
+	}
+	logSink = &sink;
+	qInstallMessageHandler(sinkLog);
+
+	QTimer logTimer;
+	QObject::connect(&logTimer, &QTimer::timeout, flushLog);
+	logTimer.start(logFlushIntervalMs);
+
+	auto finish = [](int exitCode)
+	{
+		// Whatever was logged after the last flush
+		flushLog();
+		qInstallMessageHandler(nullptr);
+		logSink = nullptr;
+		return exitCode;
+	};
+
+	QNetworkAccessManager netAccessManager;
+	WikiRegistry          registry;
+	if (!registry.load(wikiListFile))
+		return finish(ExitUsageError);
+
+	QStringList wikiNames = parser.isSet(allOption) ? registry.names() : parser.values(wikiOption);
+	if (wikiNames.isEmpty())
+		wikiNames << registry.names().first();
+	for (const QString& name : wikiNames)
+	{
+		if (!registry.coordinator(name))
+		{
+			qWarning() << "ERROR: Unknown wiki" << name << "- Listed in" << wikiListFile << ":" << registry.names();
+			return finish(ExitUsageError);
+		}
+	}
+	if (wikiNames.count() > 1 && (parser.isSet(apiOption) || parser.isSet(metricsOption)))
+	{
+		qWarning() << "ERROR: --api and --metrics only apply to a single wiki";
+		return finish(ExitUsageError);
+	}
+
+	registry.setNetworkAccessManager(&netAccessManager);
+	if (parser.isSet(concurrencyOption))
+		registry.setMaxConcurrentRequests(parser.value(concurrencyOption).toInt());
+	if (parser.isSet(maxRequestsOption))
+		registry.setMaxTotalRequests(parser.value(maxRequestsOption).toInt());
+
+	DataCoordinator* first = registry.coordinator(wikiNames.first());
+	if (parser.isSet(apiOption))
+		first->setApiUrl(QUrl::fromUserInput(parser.value(apiOption)));
+	if (parser.isSet(metricsOption))
+		first->setMetricsFile(metricsFile);
+
+	QObject::connect(&registry, &WikiRegistry::jobsFinished, [](bool success)
+	{
+		QCoreApplication::exit(success ? ExitSuccess : ExitJobFailed);
+	});
+
+	// Start the job once the event loop is running
+	QTimer::singleShot(0, [&]
+	{
+		if (command == "refresh")
+			registry.refresh(wikiNames, parser.isSet(fullOption));
+		else if (command == "rescan")
+			registry.rescan(wikiNames);
+		else if (command == "export")
+			registry.exportData(wikiNames, exportDir);
+	});
+
+	return finish(QCoreApplication::exec());
+}
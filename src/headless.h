@@ -0,0 +1,17 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <QStringList>
+
+// Whether the command line names a job (or asks for help), wherever it is among the options
+bool isHeadlessRun(int argc, char* argv[]);
+
+// Runs a single job without a GUI, e.g. "Wique refresh" from cron.
+// Logs go to stdout. Returns the process exit code.
+// Relative paths in the arguments are taken to be relative to callerPath.
+int runHeadless(const QStringList& arguments, const QString& callerPath);
+
+#endif // HEADLESS_H
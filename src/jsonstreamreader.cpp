@@ -0,0 +1,391 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "jsonstreamreader.h"
+
+static inline bool
+isJsonSpace(char c)
+{
+	return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static inline bool
+isNumberChar(char c)
+{
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+static inline int
+hexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+JsonStreamReader::JsonStreamReader(Handler* handler) :
+	handler(handler)
+{
+	reset();
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+void
+JsonStreamReader::reset()
+{
+	state = ExpectValue;
+	frames.clear();
+	token.clear();
+	stringIsKey = false;
+	escapeLength = 0;
+	unicodeValue = 0;
+	highSurrogate = 0;
+}
+
+bool
+JsonStreamReader::feed(const QByteArray& data)
+{
+	const char* p = data.constData();
+	const char* end = p + data.size();
+	while (p < end)
+	{
+		switch (state)
+		{
+		case InString:
+			if (!readString(p, end))
+				state = Error;
+			continue; // readString() moves p
+
+		case InNumber:
+			if (isNumberChar(*p))
+			{
+				token += *p++;
+				continue;
+			}
+			if (!finishNumber())
+				state = Error;
+			continue; // The terminating character is handled by the new state
+
+		case InLiteral:
+			if (*p >= 'a' && *p <= 'z')
+			{
+				token += *p++;
+				continue;
+			}
+			if (!finishLiteral())
+				state = Error;
+			continue;
+
+		case Done:
+			if (!isJsonSpace(*p))
+				state = Error;
+			++p;
+			continue;
+
+		case Error:
+			return false;
+
+		default:
+			break;
+		}
+
+		char c = *p++;
+		if (isJsonSpace(c))
+			continue;
+
+		switch (state)
+		{
+		case ExpectValueOrEnd:
+			if (c == ']')
+			{
+				if (!endContainer(c))
+					state = Error;
+				break;
+			}
+			// fall through
+		case ExpectValue:
+			if (!beginValue(c))
+				state = Error;
+			break;
+
+		case ExpectKeyOrEnd:
+			if (c == '}')
+			{
+				if (!endContainer(c))
+					state = Error;
+				break;
+			}
+			// fall through
+		case ExpectKey:
+			if (c == '"')
+			{
+				stringIsKey = true;
+				state = InString;
+			}
+			else
+				state = Error;
+			break;
+
+		case ExpectColon:
+			state = (c == ':') ? ExpectValue : Error;
+			break;
+
+		case ExpectCommaOrEnd:
+			if (c == ',')
+			{
+				Frame& frame = frames.last();
+				if (frame.isObject)
+					state = ExpectKey;
+				else
+				{
+					++frame.index;
+					state = ExpectValue;
+				}
+			}
+			else if (!endContainer(c))
+				state = Error;
+			break;
+
+		default:
+			state = Error;
+			break;
+		}
+	}
+
+	return state != Error;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+bool
+JsonStreamReader::beginValue(char c)
+{
+	switch (c)
+	{
+	case '{':
+	case '[':
+		frames.append(Frame{c == '{', QString(), 0});
+		handler->beginContainer(*this);
+		state = (c == '{') ? ExpectKeyOrEnd : ExpectValueOrEnd;
+		return true;
+
+	case '"':
+		stringIsKey = false;
+		state = InString;
+		return true;
+
+	case 't':
+	case 'f':
+	case 'n':
+		token = QByteArray(1, c);
+		state = InLiteral;
+		return true;
+
+	default:
+		if (c == '-' || (c >= '0' && c <= '9'))
+		{
+			token = QByteArray(1, c);
+			state = InNumber;
+			return true;
+		}
+		return false;
+	}
+}
+
+void
+JsonStreamReader::endValue()
+{
+	state = frames.isEmpty() ? Done : ExpectCommaOrEnd;
+}
+
+bool
+JsonStreamReader::endContainer(char c)
+{
+	if (frames.isEmpty() || c != (frames.last().isObject ? '}' : ']'))
+		return false;
+
+	handler->endContainer(*this);
+	frames.removeLast();
+	endValue();
+	return true;
+}
+
+bool
+JsonStreamReader::readString(const char*& p, const char* end)
+{
+	while (p < end)
+	{
+		if (escapeLength == 0)
+		{
+			// Copy everything up to the next quote or backslash in one go
+			const char* stop = p;
+			while (stop < end && *stop != '"' && *stop != '\\')
+				++stop;
+			if (stop != p && highSurrogate != 0)
+			{
+				appendCodePoint(0xFFFD); // Unpaired surrogate
+				highSurrogate = 0;
+			}
+			token.append(p, static_cast<int>(stop - p));
+			p = stop;
+			if (p == end)
+				return true;
+
+			if (*p++ == '\\')
+			{
+				escapeLength = 1;
+				continue;
+			}
+
+			// Closing quote
+			if (highSurrogate != 0)
+			{
+				appendCodePoint(0xFFFD); // Unpaired surrogate
+				highSurrogate = 0;
+			}
+			QString str = QString::fromUtf8(token);
+			token.clear();
+			if (stringIsKey)
+			{
+				frames.last().key = str;
+				state = ExpectColon;
+			}
+			else
+			{
+				handler->scalar(*this, QJsonValue(str));
+				endValue();
+			}
+			return true;
+		}
+
+		char c = *p++;
+		if (escapeLength == 1)
+		{
+			escapeLength = 0;
+			if (c != 'u' && highSurrogate != 0)
+			{
+				appendCodePoint(0xFFFD); // Unpaired surrogate
+				highSurrogate = 0;
+			}
+			switch (c)
+			{
+			case '"':  token += '"';  break;
+			case '\\': token += '\\'; break;
+			case '/':  token += '/';  break;
+			case 'b':  token += '\b'; break;
+			case 'f':  token += '\f'; break;
+			case 'n':  token += '\n'; break;
+			case 'r':  token += '\r'; break;
+			case 't':  token += '\t'; break;
+			case 'u':
+				escapeLength = 2;
+				unicodeValue = 0;
+				break;
+			default:
+				return false;
+			}
+			continue;
+		}
+
+		// In "\uXXXX"
+		int digit = hexValue(c);
+		if (digit < 0)
+			return false;
+		unicodeValue = (unicodeValue << 4) | static_cast<uint>(digit);
+		if (++escapeLength < 6)
+			continue;
+
+		escapeLength = 0;
+		if (unicodeValue >= 0xD800 && unicodeValue < 0xDC00)
+		{
+			if (highSurrogate != 0)
+				appendCodePoint(0xFFFD);
+			highSurrogate = unicodeValue;
+		}
+		else if (unicodeValue >= 0xDC00 && unicodeValue < 0xE000)
+		{
+			if (highSurrogate != 0)
+				appendCodePoint(0x10000 + ((highSurrogate - 0xD800) << 10) + (unicodeValue - 0xDC00));
+			else
+				appendCodePoint(0xFFFD);
+			highSurrogate = 0;
+		}
+		else
+		{
+			if (highSurrogate != 0)
+				appendCodePoint(0xFFFD);
+			highSurrogate = 0;
+			appendCodePoint(unicodeValue);
+		}
+	}
+	return true;
+}
+
+bool
+JsonStreamReader::finishNumber()
+{
+	bool ok;
+	double number = token.toDouble(&ok);
+	token.clear();
+	if (!ok)
+		return false;
+
+	handler->scalar(*this, QJsonValue(number));
+	endValue();
+	return true;
+}
+
+bool
+JsonStreamReader::finishLiteral()
+{
+	QJsonValue value;
+	if (token == "true")
+		value = QJsonValue(true);
+	else if (token == "false")
+		value = QJsonValue(false);
+	else if (token == "null")
+		value = QJsonValue(QJsonValue::Null);
+	else
+		return false;
+	token.clear();
+
+	handler->scalar(*this, value);
+	endValue();
+	return true;
+}
+
+void
+JsonStreamReader::appendCodePoint(uint codePoint)
+{
+	// Encode as UTF-8, to match the unescaped parts of the string
+	if (codePoint < 0x80)
+		token += static_cast<char>(codePoint);
+	else if (codePoint < 0x800)
+	{
+		token += static_cast<char>(0xC0 | (codePoint >> 6));
+		token += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else if (codePoint < 0x10000)
+	{
+		token += static_cast<char>(0xE0 | (codePoint >> 12));
+		token += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		token += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+	else
+	{
+		token += static_cast<char>(0xF0 | (codePoint >> 18));
+		token += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+		token += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+		token += static_cast<char>(0x80 | (codePoint & 0x3F));
+	}
+}
@@ -0,0 +1,98 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef JSONSTREAMREADER_H
+#define JSONSTREAMREADER_H
+
+#include <QByteArray>
+#include <QJsonValue>
+#include <QString>
+#include <QVector>
+
+// Push parser for JSON that arrives in pieces (e.g. from a QNetworkReply).
+//
+// Instead of building a document, it reports each container and scalar to
+// a Handler as soon as it is complete. The handler can ask the reader where
+// in the document it is, via depth() and keyAt()/indexAt(), and keep only the
+// values that it cares about.
+class JsonStreamReader
+{
+public:
+	class Handler
+	{
+	public:
+		virtual ~Handler() {}
+
+		// Called after an object/array is entered, and before it is left.
+		// The container itself is at level depth()-1.
+		virtual void beginContainer(const JsonStreamReader& reader) { Q_UNUSED(reader) }
+		virtual void endContainer(const JsonStreamReader& reader) { Q_UNUSED(reader) }
+
+		// A string, number, boolean or null at level depth()-1
+		virtual void scalar(const JsonStreamReader& reader, const QJsonValue& value) = 0;
+	};
+
+	explicit JsonStreamReader(Handler* handler);
+
+	void reset();
+
+	// Returns false as soon as the input turns out to be malformed
+	bool feed(const QByteArray& data);
+
+	bool hasError() const { return state == Error; }
+	bool isFinished() const { return state == Done; }
+
+	// Number of containers that the current value is nested in
+	int depth() const { return frames.count(); }
+
+	// Current member key / element index of the container at the given level (0 = outermost)
+	const QString& keyAt(int level) const { return frames[level].key; }
+	int indexAt(int level) const { return frames[level].index; }
+	bool isObjectAt(int level) const { return frames[level].isObject; }
+
+private:
+	enum State
+	{
+		ExpectValue,
+		ExpectValueOrEnd, // Just after '['
+		ExpectKey,
+		ExpectKeyOrEnd,   // Just after '{'
+		ExpectColon,
+		ExpectCommaOrEnd,
+		InString,
+		InNumber,
+		InLiteral,
+		Done,
+		Error
+	};
+
+	struct Frame
+	{
+		bool isObject;
+		QString key;
+		int index;
+	};
+
+	bool beginValue(char c);
+	void endValue();
+	bool endContainer(char c);
+	bool readString(const char*& p, const char* end);
+	bool finishNumber();
+	bool finishLiteral();
+	void appendCodePoint(uint codePoint);
+
+	Handler* handler;
+	State state;
+	QVector<Frame> frames;
+
+	// Raw bytes of the current string (as UTF-8), number or literal
+	QByteArray token;
+	bool stringIsKey;
+
+	// Escape sequences can be split across pieces
+	int escapeLength; // 0 = none, 1 = after '\', 2-5 = in "\uXXXX"
+	uint unicodeValue;
+	uint highSurrogate;
+};
+
+#endif // JSONSTREAMREADER_H
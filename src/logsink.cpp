@@ -0,0 +1,215 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "logsink.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QTextStream>
+#include <QThread>
+
+#include <QDebug>
+
+static quint64
+roundUpToPowerOfTwo(int value)
+{
+	quint64 result = 2;
+	while (result < static_cast<quint64>(value))
+		result <<= 1;
+	return result;
+}
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+LogSink::LogSink(int capacity) :
+	slots(new Slot[roundUpToPowerOfTwo(capacity)]),
+	mask(roundUpToPowerOfTwo(capacity) - 1),
+	writePos(0),
+	readPos(0),
+	dropped(0),
+	minLevel(LogLevel::Debug),
+	draining(false),
+	maxFileBytes(0),
+	maxFileCount(0)
+{
+	for (quint64 i = 0; i <= mask; ++i)
+		slots[i].sequence.store(i);
+}
+
+LogSink::~LogSink()
+{
+	logFile.close();
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+LogLevel
+LogSink::levelOf(QtMsgType type)
+{
+	switch (type)
+	{
+	case QtDebugMsg:    return LogLevel::Debug;
+	case QtInfoMsg:     return LogLevel::Info;
+	case QtWarningMsg:  return LogLevel::Warning;
+	case QtCriticalMsg: return LogLevel::Critical;
+	case QtFatalMsg:    return LogLevel::Fatal;
+	}
+	return LogLevel::Debug;
+}
+
+QString
+LogSink::nameOf(LogLevel level)
+{
+	switch (level)
+	{
+	case LogLevel::Debug:    return "debug";
+	case LogLevel::Info:     return "info";
+	case LogLevel::Warning:  return "warning";
+	case LogLevel::Critical: return "critical";
+	case LogLevel::Fatal:    return "fatal";
+	}
+	return QString();
+}
+
+bool
+LogSink::setLogFile(const QString& path, qint64 maxBytes, int maxFiles)
+{
+	logFile.close();
+	logFile.setFileName(path);
+	maxFileBytes = maxBytes;
+	maxFileCount = maxFiles;
+	return logFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+}
+
+bool
+LogSink::post(QtMsgType type, const QString& message)
+{
+	LogLevel level = levelOf(type);
+	if (level < minLevel)
+		return true;
+
+	// Bounded multi-producer queue, after Dmitry Vyukov's design.
+	// A slot is free for position pos when its sequence == pos, and filled when its sequence == pos + 1.
+	Slot* slot;
+	quint64 pos = writePos.load();
+	for (;;)
+	{
+		slot = &slots[pos & mask];
+		qint64 diff = static_cast<qint64>(slot->sequence.loadAcquire() - pos);
+		if (diff == 0)
+		{
+			// Claim the slot. On failure, pos is updated to the latest write position.
+			if (writePos.testAndSetRelaxed(pos, pos + 1, pos))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// Full. The consumer hasn't caught up.
+			dropped.fetchAndAddRelaxed(1);
+			return false;
+		}
+		else
+			pos = writePos.load();
+	}
+
+	slot->entry.level = level;
+	slot->entry.timestamp = QDateTime::currentMSecsSinceEpoch();
+	slot->entry.message = message;
+	slot->sequence.storeRelease(pos + 1);
+	return true;
+}
+
+bool
+LogSink::postFromHandler(QtMsgType type, const QString& message, const std::function<void()>& flush)
+{
+	QCoreApplication* app = QCoreApplication::instance();
+	if (app && QThread::currentThread() == app->thread() && isNearlyFull())
+		flush();
+	return post(type, message);
+}
+
+QVector<LogEntry>
+LogSink::drain()
+{
+	QVector<LogEntry> entries;
+
+	// Writing the log file may log (e.g. if it can't be rotated), which may lead back here
+	if (draining)
+		return entries;
+	draining = true;
+
+	quint64 lostCount = dropped.fetchAndStoreRelaxed(0);
+	if (lostCount > 0)
+	{
+		entries << LogEntry{LogLevel::Warning, QDateTime::currentMSecsSinceEpoch(),
+				QString("ERROR: LogSink: %1 messages were dropped").arg(lostCount)};
+	}
+
+	for (;;)
+	{
+		Slot& slot = slots[readPos & mask];
+		if (slot.sequence.loadAcquire() != readPos + 1)
+			break; // Empty, or still being written
+
+		entries << LogEntry();
+		qSwap(entries.last(), slot.entry);
+
+		// Hand the slot back to the producers, for the next lap around the ring
+		slot.sequence.storeRelease(readPos + mask + 1);
+		++readPos;
+	}
+
+	if (logFile.isOpen() && !entries.isEmpty())
+		writeToFile(entries);
+	draining = false;
+	return entries;
+}
+
+bool
+LogSink::isNearlyFull() const
+{
+	quint64 capacity = mask + 1;
+	return writePos.load() - readPos >= capacity - capacity / 4;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+void
+LogSink::writeToFile(const QVector<LogEntry>& entries)
+{
+	QTextStream out(&logFile);
+	out.setCodec("UTF-8");
+	for (const LogEntry& entry : entries)
+	{
+		out << QDateTime::fromMSecsSinceEpoch(entry.timestamp).toString(Qt::ISODateWithMs) << ' '
+				<< nameOf(entry.level).toUpper() << ' '
+				<< entry.message << '\n';
+	}
+	out.flush();
+
+	if (maxFileBytes > 0 && logFile.size() >= maxFileBytes)
+		rotateLogFile();
+}
+
+void
+LogSink::rotateLogFile()
+{
+	// wique.log -> wique.log.1 -> wique.log.2 -> ... The oldest one is deleted.
+	QString path = logFile.fileName();
+	logFile.close();
+
+	QFile::remove(QString("%1.%2").arg(path).arg(maxFileCount));
+	for (int i = maxFileCount - 1; i >= 1; --i)
+		QFile::rename(QString("%1.%2").arg(path).arg(i), QString("%1.%2").arg(path).arg(i + 1));
+	if (maxFileCount > 0)
+		QFile::rename(path, path + ".1");
+	else
+		QFile::remove(path);
+
+	logFile.setFileName(path);
+	if (!logFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+		qWarning() << "ERROR: LogSink: Cannot reopen" << path;
+}
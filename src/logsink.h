@@ -0,0 +1,101 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <QAtomicInteger>
+#include <QFile>
+#include <QScopedArrayPointer>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+
+// Ordered by severity, unlike QtMsgType
+enum class LogLevel
+{
+	Debug,
+	Info,
+	Warning,
+	Critical,
+	Fatal
+};
+
+struct LogEntry
+{
+	LogLevel level;
+	qint64 timestamp; // ms since the epoch
+	QString message;
+};
+
+// Collects log messages from any thread, for one consumer to drain in batches.
+//
+// post() never blocks and never takes a lock: the messages go into a
+// fixed-size ring buffer, so that logging stays cheap in the middle of a
+// refresh. If the consumer falls behind and the buffer fills up, new messages
+// are dropped (and counted) instead of piling up in memory.
+//
+// Drained messages can also be written to a log file, which is rotated once
+// it grows too big.
+class LogSink
+{
+public:
+	explicit LogSink(int capacity = 8192);
+	~LogSink();
+
+	static LogLevel levelOf(QtMsgType type);
+	static QString nameOf(LogLevel level);
+
+	// Messages below this level are discarded right away
+	void setMinimumLevel(LogLevel level) { minLevel = level; }
+	LogLevel minimumLevel() const { return minLevel; }
+
+	// Keeps at most maxFiles old logs (path.1 = Newest). Returns false if the file can't be opened.
+	bool setLogFile(const QString& path, qint64 maxBytes = 10 * 1024 * 1024, int maxFiles = 3);
+
+	// Thread-safe. Returns false if the message was dropped.
+	bool post(QtMsgType type, const QString& message);
+
+	// post(), for message handlers whose consumer drains in the main thread. The main
+	// thread logs most messages itself, and a burst (e.g. a big chunk written by Database)
+	// would fill the buffer before the consumer's next turn. So in the main thread, flush()
+	// is called as soon as the buffer is nearly full, instead of dropping messages.
+	bool postFromHandler(QtMsgType type, const QString& message, const std::function<void()>& flush);
+
+	// Takes out everything posted so far, oldest first, and writes it to the log file.
+	// Returns nothing if called again while draining (e.g. from a message handler).
+	// NOTE: Only one thread may drain.
+	QVector<LogEntry> drain();
+
+	// True once the buffer is three quarters full. A consumer that also posts
+	// (e.g. the main thread) should drain right away then, instead of waiting
+	// for its next turn and losing messages.
+	// NOTE: Only meaningful on the draining thread.
+	bool isNearlyFull() const;
+
+private:
+	struct Slot
+	{
+		// Tells producers and the consumer whose turn it is (see post())
+		QAtomicInteger<quint64> sequence;
+		LogEntry entry;
+	};
+
+	void writeToFile(const QVector<LogEntry>& entries);
+	void rotateLogFile();
+
+	QScopedArrayPointer<Slot> slots;
+	const quint64 mask; // Capacity - 1
+	QAtomicInteger<quint64> writePos;
+	quint64 readPos;
+	QAtomicInteger<quint64> dropped;
+	LogLevel minLevel;
+	bool draining;
+
+	QFile logFile;
+	qint64 maxFileBytes;
+	int maxFileCount;
+};
+
+#endif // LOGSINK_H
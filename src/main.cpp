@@ -6,72 +6,114 @@
 #include <QNetworkCookieJar>
 #include <QStandardPaths>
 #include <QDir>
+#include <QScopedPointer>
 
-#include "datacoordinator.h"
+#include "headless.h"
+#include "logsink.h"
+#include "wikiregistry.h"
 #include "gui/databaseui.h"
 
+#include <cstdio>
+
 #include <QDebug>
 
 DatabaseUI *ui;
+LogSink *logSink;
 
 static void
 uiLog(QtMsgType type, const QMessageLogContext&, const QString& msg)
 {
-	switch (type)
+	// Any thread may log. The GUI picks the messages up from the sink (see DatabaseUI::setLogSink()).
+	logSink->postFromHandler(type, msg, []
+	{
+		ui->flushLog();
+	});
+
+	// There's no time left to show it in the GUI
+	if (type == QtFatalMsg)
 	{
-	case QtDebugMsg:
-	case QtWarningMsg:
-	case QtCriticalMsg:
-		ui->writeLog(msg);
-		break;
-	case QtFatalMsg:
-		ui->writeLog(msg);
+		std::fprintf(stderr, "%s\n", msg.toUtf8().constData());
 		abort();
 	}
 }
 
 int main(int argc, char *argv[])
 {
-	QApplication a(argc, argv);
+	// A command on the command line means a run without the GUI (see headless.cpp)
+	bool headless = isHeadlessRun(argc, argv);
+	QScopedPointer<QCoreApplication> app(headless
+			? new QCoreApplication(argc, argv)
+			: new QApplication(argc, argv));
 
-	// cd into the folder which contains the database file
+	// cd into the folder which contains the database file.
+	// NOTE: Paths on the command line are relative to where the user was.
+	QString callerPath = QDir::currentPath();
 	QString dataPath = QStandardPaths::writableLocation(QStandardPaths::DataLocation);
 	QDir dir;
 	dir.mkpath(dataPath);
 	QDir::setCurrent(dataPath);
 
+	if (headless)
+		return runHeadless(app->arguments(), callerPath);
+
 	// Initialize GUI and direct log entries into it
+	logSink = new LogSink;
 	ui = new DatabaseUI;
+	ui->setLogSink(logSink);
 	qInstallMessageHandler(uiLog);
 
 	// Initialize and link up other components
 	QNetworkAccessManager netAccessManager;
 //	QNetworkCookieJar     netCookieJar;
-	DataCoordinator       dataCoordinator;
+	WikiRegistry          registry;
+
+	registry.load("wikis.json"); // Falls back to the Qt Wiki
 
-	ui->setDbModel(dataCoordinator.dbModel());
 //	netAccessManager.setCookieJar(&netCookieJar);
-	dataCoordinator.setNetworkAccessManager(&netAccessManager);
+	registry.setNetworkAccessManager(&netAccessManager);
+
+	// The wiki shown in the GUI, which single-wiki jobs work on
+	QString currentWiki = registry.names().first();
+	ui->setDbModel(registry.coordinator(currentWiki)->dbModel());
+	ui->setWikiNames(registry.names());
 
 	// Handle signals from the GUI
+	QObject::connect(ui, &DatabaseUI::wikiSelected, [&](const QString& name)
+	{
+		if (!registry.coordinator(name))
+			return;
+		currentWiki = name;
+		ui->setDbModel(registry.coordinator(name)->dbModel());
+	});
 	QObject::connect(ui, &DatabaseUI::refreshDbRequested, [&]
 	{
 		ui->setButtonsEnabled(false);
-		dataCoordinator.refreshDatabase();
+		registry.refresh({currentWiki});
+	});
+	QObject::connect(ui, &DatabaseUI::refreshAllRequested, [&]
+	{
+		ui->setButtonsEnabled(false);
+		registry.refresh(registry.names());
 	});
 	QObject::connect(ui, &DatabaseUI::forceRederiveRequested, [&]
 	{
 		ui->setButtonsEnabled(false);
-		dataCoordinator.forceRederiveData();
+		registry.rescan({currentWiki});
 	});
 	QObject::connect(ui, &DatabaseUI::exportRequested, [&](const QString& exportDir)
 	{
 		ui->setButtonsEnabled(false);
-		dataCoordinator.exportData(exportDir);
+		registry.exportData({currentWiki}, exportDir);
+	});
+	QObject::connect(ui, &DatabaseUI::searchRequested, [&](const QString& query)
+	{
+		auto hits = registry.coordinator(currentWiki)->search(query);
+		qDebug() << "Found" << hits.count() << "pages matching" << query;
+		ui->showSearchResults(hits);
 	});
 
-	// Handle signals from the DataCoordinator
-	QObject::connect(&dataCoordinator, &DataCoordinator::currentJobFinished, [=]
+	// Handle signals from the DataCoordinators
+	QObject::connect(&registry, &WikiRegistry::jobsFinished, [=]
 	{
 		ui->setButtonsEnabled(true);
 	});
@@ -79,5 +121,5 @@ int main(int argc, char *argv[])
 	// Good to go!
 	ui->show();
 
-	return a.exec();
+	return app->exec();
 }
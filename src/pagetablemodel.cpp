@@ -0,0 +1,322 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "pagetablemodel.h"
+
+#include <QSet>
+#include <QSqlError>
+#include <QSqlQuery>
+
+#include <algorithm>
+#include <functional>
+
+#include <QDebug>
+
+static const QStringList columnNames{"id", "redirection", "timestamp", "title", "finalTarget", "redirectStatus"};
+
+// Number of rows fetched by a single query
+static const int windowSize = 256;
+
+// Rows whose values are kept. The least recently shown ones are dropped first.
+static const int maxCachedRows = 64 * windowSize;
+
+// Beyond this many rows coming or going at once, the view is reset instead
+static const int maxIncrementalChanges = windowSize;
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+PageTableModel::PageTableModel(const QSqlDatabase& db, QObject* parent) :
+	QAbstractTableModel(parent),
+	_db(db),
+	_sortColumn(0),
+	_sortOrder(Qt::AscendingOrder),
+	_cache(maxCachedRows)
+{
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+int
+PageTableModel::rowCount(const QModelIndex& parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return _ids.count();
+}
+
+int
+PageTableModel::columnCount(const QModelIndex& parent) const
+{
+	if (parent.isValid())
+		return 0;
+	return columnNames.count();
+}
+
+QVariant
+PageTableModel::data(const QModelIndex& index, int role) const
+{
+	if (!index.isValid() || (role != Qt::DisplayRole && role != Qt::EditRole))
+		return QVariant();
+
+	int id = _ids[index.row()];
+	if (!_cache.contains(id))
+		fetchWindow(index.row());
+
+	const QVector<QVariant>* values = _cache.object(id);
+	return values ? values->value(index.column()) : QVariant();
+}
+
+QVariant
+PageTableModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	if (orientation == Qt::Horizontal && role == Qt::DisplayRole)
+		return columnNames.value(section);
+	return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+void
+PageTableModel::sort(int column, Qt::SortOrder order)
+{
+	if (column < 0 || column >= columnNames.count())
+		return;
+	if (column == _sortColumn && order == _sortOrder)
+		return;
+
+	_sortColumn = column;
+	_sortOrder = order;
+	applyIds(queryIds());
+}
+
+void
+PageTableModel::setTitleFilter(const QString& text)
+{
+	if (text == _titleFilter)
+		return;
+
+	_titleFilter = text;
+	applyIds(queryIds());
+}
+
+void
+PageTableModel::reload()
+{
+	beginResetModel();
+
+	_ids = queryIds();
+	_cache.clear();
+	reindexRows();
+
+	endResetModel();
+}
+
+void
+PageTableModel::refreshPages(const QVector<int>& pageIds)
+{
+	// Rows may move, appear or disappear when the values that they are sorted or filtered by change
+	if (!hasDefaultOrder())
+	{
+		for (int id : pageIds)
+		{
+			int row = _rows.value(id, -1);
+			_cache.remove(id);
+			if (row != -1)
+				emit dataChanged(index(row, 0), index(row, columnNames.count()-1));
+		}
+		applyIds(queryIds());
+		return;
+	}
+
+	// Existing rows: Just forget the old values. They will be re-fetched on demand.
+	QVector<int> newIds;
+	for (int id : pageIds)
+	{
+		int row = _rows.value(id, -1);
+		if (row == -1)
+		{
+			newIds << id;
+			continue;
+		}
+
+		_cache.remove(id);
+		emit dataChanged(index(row, 0), index(row, columnNames.count()-1));
+	}
+	if (newIds.isEmpty())
+		return;
+
+	// New rows: Insert them in ID order
+	std::sort(newIds.begin(), newIds.end());
+	newIds.erase(std::unique(newIds.begin(), newIds.end()), newIds.end());
+	for (int id : newIds)
+	{
+		int row = std::lower_bound(_ids.begin(), _ids.end(), id) - _ids.begin();
+		beginInsertRows(QModelIndex(), row, row);
+		_ids.insert(row, id);
+		endInsertRows();
+	}
+	reindexRows();
+}
+
+void
+PageTableModel::removePages(const QVector<int>& pageIds)
+{
+	QVector<int> rows;
+	for (int id : pageIds)
+	{
+		int row = _rows.value(id, -1);
+		if (row != -1)
+			rows << row;
+		_cache.remove(id);
+	}
+	if (rows.isEmpty())
+		return;
+
+	// Remove from the bottom up, so that the remaining row numbers stay valid
+	std::sort(rows.begin(), rows.end(), std::greater<int>());
+	rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+	for (int row : rows)
+	{
+		beginRemoveRows(QModelIndex(), row, row);
+		_ids.remove(row);
+		endRemoveRows();
+	}
+	reindexRows();
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+QVector<int>
+PageTableModel::queryIds() const
+{
+	QString direction = (_sortOrder == Qt::AscendingOrder) ? "ASC" : "DESC";
+	QString sql = "SELECT id FROM Pages";
+	if (!_titleFilter.isEmpty())
+		sql += " WHERE title LIKE :pattern ESCAPE '\\'";
+	sql += QString(" ORDER BY %1 %2").arg(columnNames[_sortColumn], direction);
+	if (_sortColumn != 0)
+		sql += QString(", id %1").arg(direction);
+
+	// The filter is a plain substring, not a LIKE pattern
+	QString pattern = _titleFilter;
+	pattern.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	q.prepare(sql);
+	if (!_titleFilter.isEmpty())
+		q.bindValue(":pattern", "%" + pattern + "%");
+	if (!q.exec())
+		qWarning() << "ERROR: PageTableModel: Loading IDs:" << q.lastError();
+
+	QVector<int> ids;
+	while (q.next())
+		ids << q.value(0).toInt();
+	return ids;
+}
+
+void
+PageTableModel::applyIds(const QVector<int>& ids)
+{
+	QSet<int> newIds;
+	newIds.reserve(ids.count());
+	for (int id : ids)
+		newIds.insert(id);
+
+	QVector<int> removedIds;
+	for (int id : _ids)
+		if (!newIds.contains(id))
+			removedIds << id;
+	int addedCount = ids.count() - (_ids.count() - removedIds.count());
+
+	// e.g. a new filter. Row by row would take longer than starting over.
+	if (removedIds.count() + addedCount > maxIncrementalChanges)
+	{
+		beginResetModel();
+		_ids = ids;
+		reindexRows();
+		endResetModel();
+		return;
+	}
+
+	// 1. Rows that are no longer shown
+	removePages(removedIds);
+
+	// 2. Rows that are still shown, in their new order
+	QVector<int> keptIds;
+	for (int id : ids)
+		if (_rows.contains(id))
+			keptIds << id;
+	if (keptIds != _ids)
+	{
+		emit layoutAboutToBeChanged();
+		QVector<int> oldIds = _ids;
+		_ids = keptIds;
+		reindexRows();
+
+		QModelIndexList oldIndexes = persistentIndexList();
+		QModelIndexList newIndexes;
+		for (const QModelIndex& oldIndex : oldIndexes)
+			newIndexes << index(_rows.value(oldIds[oldIndex.row()]), oldIndex.column());
+		changePersistentIndexList(oldIndexes, newIndexes);
+		emit layoutChanged();
+	}
+
+	// 3. New rows. Everything before each one is in place by the time that it is inserted.
+	QSet<int> shownIds;
+	for (int id : keptIds)
+		shownIds.insert(id);
+	for (int row = 0; row < ids.count(); ++row)
+	{
+		if (shownIds.contains(ids[row]))
+			continue;
+		beginInsertRows(QModelIndex(), row, row);
+		_ids.insert(row, ids[row]);
+		endInsertRows();
+	}
+	if (addedCount > 0)
+		reindexRows();
+}
+
+void
+PageTableModel::fetchWindow(int row) const
+{
+	int first = row - row % windowSize;
+	int last = qMin(first + windowSize, _ids.count()) - 1;
+
+	// Rows can be in any order, so the window's IDs are listed one by one
+	QStringList idList;
+	for (int i = first; i <= last; ++i)
+		idList << QString::number(_ids[i]);
+
+	QSqlQuery q(_db);
+	q.setForwardOnly(true);
+	if (!q.exec("SELECT id, redirection, timestamp, title, finalTarget, redirectStatus FROM Pages WHERE id IN ("
+			+ idList.join(',') + ")"))
+	{
+		qWarning() << "ERROR: PageTableModel: Loading rows" << first << "to" << last << ":" << q.lastError();
+	}
+
+	while (q.next())
+	{
+		auto values = new QVector<QVariant>;
+		for (int col = 0; col < columnNames.count(); ++col)
+			*values << q.value(col);
+		_cache.insert(q.value(0).toInt(), values);
+	}
+
+	// Don't query again for rows that have vanished from the table
+	for (int i = first; i <= last; ++i)
+		if (!_cache.contains(_ids[i]))
+			_cache.insert(_ids[i], new QVector<QVariant>);
+}
+
+void
+PageTableModel::reindexRows()
+{
+	_rows.clear();
+	_rows.reserve(_ids.count());
+	for (int row = 0; row < _ids.count(); ++row)
+		_rows.insert(_ids[row], row);
+}
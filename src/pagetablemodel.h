@@ -0,0 +1,72 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef PAGETABLEMODEL_H
+#define PAGETABLEMODEL_H
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QSqlDatabase>
+#include <QVector>
+#include <QHash>
+
+// Shows the metadata of the Pages table.
+//
+// Only the page IDs are loaded up front. The other columns are fetched from
+// SQLite in windows of rows, the first time that a view asks for them, and
+// only the most recently used windows are kept.
+// SQLite sorts and filters the rows, so that a view doesn't have to read every
+// row to do it (as QSortFilterProxyModel would).
+// Changes are applied as row insertions/removals/updates instead of a full
+// reset, so views keep their sort order and scroll position.
+class PageTableModel : public QAbstractTableModel
+{
+	Q_OBJECT
+
+public:
+	explicit PageTableModel(const QSqlDatabase& db, QObject* parent = nullptr);
+
+	int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex& parent = QModelIndex()) const override;
+	QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+
+	void sort(int column, Qt::SortOrder order = Qt::AscendingOrder) override;
+	int sortColumn() const { return _sortColumn; }
+	Qt::SortOrder sortOrder() const { return _sortOrder; }
+
+	// Only shows the pages whose title contains text (ignoring the case of ASCII letters).
+	// Empty = All pages.
+	void setTitleFilter(const QString& text);
+	QString titleFilter() const { return _titleFilter; }
+
+	void reload();
+	void refreshPages(const QVector<int>& pageIds);
+	void removePages(const QVector<int>& pageIds);
+
+private:
+	// Sorted by ID and unfiltered, so that new rows can be placed without asking SQLite
+	bool hasDefaultOrder() const
+	{ return _sortColumn == 0 && _sortOrder == Qt::AscendingOrder && _titleFilter.isEmpty(); }
+
+	QVector<int> queryIds() const;
+	void applyIds(const QVector<int>& ids);
+	void fetchWindow(int row) const;
+	void reindexRows();
+
+	QSqlDatabase _db;
+	int _sortColumn;
+	Qt::SortOrder _sortOrder;
+	QString _titleFilter;
+
+	// Row -> ID, sorted by _sortColumn (then by ID)
+	QVector<int> _ids;
+
+	// ID -> Row
+	QHash<int, int> _rows;
+
+	// ID -> Column values, of the most recently shown rows
+	mutable QCache<int, QVector<QVariant>> _cache;
+};
+
+#endif // PAGETABLEMODEL_H
@@ -0,0 +1,25 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef QUERYRESULTS_H
+#define QUERYRESULTS_H
+
+#include <QString>
+
+// Answers from Database, as shown by the GUI
+
+struct SearchHit
+{
+	int pageId;
+	QString title;
+	QString snippet;
+	double score; // Lower is better
+};
+
+struct WantedPage
+{
+	QString title;
+	int linkCount; // Number of pages that link to it
+};
+
+#endif // QUERYRESULTS_H
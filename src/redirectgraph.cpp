@@ -0,0 +1,180 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "redirectgraph.h"
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+QString
+RedirectGraph::statusName(Status status)
+{
+	switch (status)
+	{
+	case NotRedirect:    return QString();
+	case Resolved:       return "resolved";
+	case DoubleRedirect: return "double";
+	case Broken:         return "broken";
+	case Loop:           return "loop";
+	}
+	return QString();
+}
+
+RedirectGraph::Status
+RedirectGraph::statusFromName(const QString& name)
+{
+	if (name == "resolved")
+		return Resolved;
+	if (name == "double")
+		return DoubleRedirect;
+	if (name == "broken")
+		return Broken;
+	if (name == "loop")
+		return Loop;
+	return NotRedirect;
+}
+
+void
+RedirectGraph::clear()
+{
+	titles.clear();
+	ids.clear();
+	targets.clear();
+	redirectsTo.clear();
+	resolutions.clear();
+	dirtyIds.clear();
+	dirtyTitles.clear();
+}
+
+void
+RedirectGraph::setPage(int id, const QString& title, const QString& redirectTarget)
+{
+	if (titles.contains(id))
+	{
+		if (titles[id] == title && targets.value(id) == redirectTarget)
+			return;
+
+		// Whatever led to the old title has to be looked at again too
+		markDirty(id);
+		if (ids.value(titles[id]) == id)
+			ids.remove(titles[id]);
+		if (targets.contains(id))
+			redirectsTo[targets.take(id)].remove(id);
+	}
+
+	titles[id] = title;
+	ids[title] = id;
+	if (!redirectTarget.isEmpty())
+	{
+		targets[id] = redirectTarget;
+		redirectsTo[redirectTarget].insert(id);
+	}
+	markDirty(id);
+}
+
+void
+RedirectGraph::removePage(int id)
+{
+	if (!titles.contains(id))
+		return;
+
+	markDirty(id);
+	QString title = titles.take(id);
+	if (ids.value(title) == id)
+		ids.remove(title);
+	if (targets.contains(id))
+		redirectsTo[targets.take(id)].remove(id);
+	resolutions.remove(id);
+}
+
+QHash<int, RedirectGraph::Resolution>
+RedirectGraph::resolveChanged()
+{
+	// Walk the redirects backwards from every title that changed
+	QSet<int> affected;
+	for (int id : dirtyIds)
+		if (titles.contains(id))
+			affected.insert(id);
+
+	QVector<QString> pendingTitles = dirtyTitles.toList().toVector();
+	while (!pendingTitles.isEmpty())
+	{
+		QString title = pendingTitles.takeLast();
+		for (int id : redirectsTo.value(title))
+		{
+			if (affected.contains(id))
+				continue;
+			affected.insert(id);
+			pendingTitles << titles[id];
+		}
+	}
+	dirtyIds.clear();
+	dirtyTitles.clear();
+
+	QHash<int, Resolution> changes;
+	for (int id : affected)
+	{
+		Resolution r = resolve(id);
+		auto it = resolutions.find(id);
+		if (it != resolutions.end() && it.value() == r)
+			continue;
+		resolutions[id] = r;
+		changes[id] = r;
+	}
+	return changes;
+}
+
+RedirectGraph::Resolution
+RedirectGraph::resolution(int id) const
+{
+	return resolutions.value(id, Resolution{-1, -1, NotRedirect});
+}
+
+int
+RedirectGraph::count(Status status) const
+{
+	int n = 0;
+	for (const Resolution& r : resolutions)
+		if (r.status == status)
+			++n;
+	return n;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+RedirectGraph::Resolution
+RedirectGraph::resolve(int id) const
+{
+	if (!targets.contains(id))
+		return Resolution{-1, id, NotRedirect};
+
+	int target = ids.value(targets[id], -1);
+	if (target == -1)
+		return Resolution{-1, -1, Broken};
+
+	// Follow the chain. Every page may be visited only once.
+	QSet<int> visited{id};
+	int current = target;
+	int hops = 1;
+	while (targets.contains(current))
+	{
+		if (visited.contains(current))
+			return Resolution{target, -1, Loop};
+		visited.insert(current);
+
+		current = ids.value(targets[current], -1);
+		if (current == -1)
+			return Resolution{target, -1, Broken};
+		++hops;
+	}
+	return Resolution{target, current, hops == 1 ? Resolved : DoubleRedirect};
+}
+
+void
+RedirectGraph::markDirty(int id)
+{
+	dirtyIds.insert(id);
+	if (titles.contains(id))
+		dirtyTitles.insert(titles[id]);
+}
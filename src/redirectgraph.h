@@ -0,0 +1,74 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef REDIRECTGRAPH_H
+#define REDIRECTGRAPH_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+// Every page's title and redirect target, for following redirects to the end
+// of the chain without asking the database.
+//
+// Pages are registered with setPage()/removePage(). resolveChanged() then
+// re-resolves only the pages that could be affected: the changed pages
+// themselves, and every redirect that leads to them (directly or through
+// other redirects).
+class RedirectGraph
+{
+public:
+	enum Status
+	{
+		NotRedirect,
+		Resolved,       // Points straight at a page that isn't a redirect
+		DoubleRedirect, // Reaches a page that isn't a redirect, but via other redirects
+		Broken,         // Some redirect in the chain points at a page that doesn't exist
+		Loop            // The chain comes back on itself
+	};
+
+	struct Resolution
+	{
+		int target;      // The page that is linked to, or -1 if it doesn't exist
+		int finalTarget; // The page that a reader ends up on, or -1 if there is none
+		Status status;
+
+		bool operator==(const Resolution& other) const
+		{ return target == other.target && finalTarget == other.finalTarget && status == other.status; }
+		bool operator!=(const Resolution& other) const
+		{ return !(*this == other); }
+	};
+
+	static QString statusName(Status status);
+	static Status statusFromName(const QString& name);
+
+	void clear();
+	int pageCount() const { return titles.count(); }
+
+	// An empty redirectTarget means that the page isn't a redirect
+	void setPage(int id, const QString& title, const QString& redirectTarget);
+	void removePage(int id);
+
+	// Resolves the pages that are affected by setPage()/removePage() since the
+	// last call, and returns their new resolutions (removed pages excluded)
+	QHash<int, Resolution> resolveChanged();
+
+	Resolution resolution(int id) const;
+	int count(Status status) const;
+
+private:
+	Resolution resolve(int id) const;
+	void markDirty(int id);
+
+	QHash<int, QString> titles;
+	QHash<QString, int> ids;
+	QHash<int, QString> targets; // Redirects only
+	QHash<QString, QSet<int>> redirectsTo; // Target title -> Redirects that point at it
+	QHash<int, Resolution> resolutions;
+
+	QSet<int> dirtyIds;
+	QSet<QString> dirtyTitles;
+};
+
+#endif // REDIRECTGRAPH_H
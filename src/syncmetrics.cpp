@@ -0,0 +1,250 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "syncmetrics.h"
+
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+
+#include <QDebug>
+
+// Upper bounds of the histogram buckets. Fits latencies and durations in ms.
+static const QVector<double> bucketBounds{5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000};
+
+static const QString metricPrefix = "wique_";
+
+static QString
+formatBound(double bound)
+{
+	return QString::number(bound, 'g', 10);
+}
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+SyncMetrics::SyncMetrics() :
+	_success(false),
+	_jobMs(0)
+{
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+void
+SyncMetrics::beginJob(const QString& jobName)
+{
+	QMutexLocker locker(&mutex);
+	_jobName = jobName;
+	_success = false;
+	_finishedAt.clear();
+	_jobMs = 0;
+	runningPhases.clear();
+	phaseMs.clear();
+	counters.clear();
+	gauges.clear();
+	histograms.clear();
+	_jobTimer.start();
+}
+
+void
+SyncMetrics::endJob(bool success)
+{
+	QMutexLocker locker(&mutex);
+	_success = success;
+	_jobMs = _jobTimer.elapsed();
+	_finishedAt = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+
+	// A phase that was cut short still took time
+	for (auto it = runningPhases.constBegin(); it != runningPhases.constEnd(); ++it)
+		phaseMs[it.key()] += it.value().elapsed();
+	runningPhases.clear();
+}
+
+void
+SyncMetrics::beginPhase(const QString& phase)
+{
+	QMutexLocker locker(&mutex);
+	runningPhases[phase].start();
+}
+
+void
+SyncMetrics::endPhase(const QString& phase)
+{
+	QMutexLocker locker(&mutex);
+	if (!runningPhases.contains(phase))
+		return;
+	phaseMs[phase] += runningPhases.take(phase).elapsed();
+}
+
+void
+SyncMetrics::add(const QString& counter, qint64 amount)
+{
+	QMutexLocker locker(&mutex);
+	counters[counter] += amount;
+}
+
+void
+SyncMetrics::setGauge(const QString& gauge, double value)
+{
+	QMutexLocker locker(&mutex);
+	gauges[gauge] = value;
+}
+
+void
+SyncMetrics::observe(const QString& histogram, double value)
+{
+	QMutexLocker locker(&mutex);
+	Histogram& h = histograms[histogram];
+	if (h.bucketCounts.isEmpty())
+	{
+		h.bucketCounts.fill(0, bucketBounds.count() + 1);
+		h.sum = 0;
+		h.count = 0;
+	}
+
+	int bucket = 0;
+	while (bucket < bucketBounds.count() && value > bucketBounds[bucket])
+		++bucket;
+	++h.bucketCounts[bucket];
+	h.sum += value;
+	++h.count;
+}
+
+qint64
+SyncMetrics::counter(const QString& counter) const
+{
+	QMutexLocker locker(&mutex);
+	return counters.value(counter);
+}
+
+qint64
+SyncMetrics::phaseMilliseconds(const QString& phase) const
+{
+	QMutexLocker locker(&mutex);
+	qint64 ms = phaseMs.value(phase);
+	if (runningPhases.contains(phase))
+		ms += runningPhases[phase].elapsed();
+	return ms;
+}
+
+bool
+SyncMetrics::writeTo(const QString& filePath) const
+{
+	bool prometheus = filePath.endsWith(".prom") || filePath.endsWith(".txt");
+
+	QSaveFile file(filePath);
+	if (!file.open(QIODevice::WriteOnly)
+			|| file.write(prometheus ? toPrometheus() : toJson()) < 0
+			|| !file.commit())
+	{
+		qWarning() << "ERROR: SyncMetrics: Writing" << filePath << ":" << file.errorString();
+		return false;
+	}
+	return true;
+}
+
+QByteArray
+SyncMetrics::toJson() const
+{
+	QMutexLocker locker(&mutex);
+
+	QJsonObject phasesObj;
+	for (auto it = phaseMs.constBegin(); it != phaseMs.constEnd(); ++it)
+		phasesObj[it.key()] = it.value() / 1000.0;
+
+	QJsonObject countersObj;
+	for (auto it = counters.constBegin(); it != counters.constEnd(); ++it)
+		countersObj[it.key()] = static_cast<double>(it.value());
+
+	QJsonObject gaugesObj;
+	for (auto it = gauges.constBegin(); it != gauges.constEnd(); ++it)
+		gaugesObj[it.key()] = it.value();
+
+	QJsonObject histogramsObj;
+	for (auto it = histograms.constBegin(); it != histograms.constEnd(); ++it)
+	{
+		// Cumulative, like Prometheus' buckets
+		QJsonObject bucketsObj;
+		qint64 cumulative = 0;
+		for (int i = 0; i < bucketBounds.count(); ++i)
+		{
+			cumulative += it.value().bucketCounts[i];
+			bucketsObj[formatBound(bucketBounds[i])] = static_cast<double>(cumulative);
+		}
+		bucketsObj["+Inf"] = static_cast<double>(it.value().count);
+
+		QJsonObject histogramObj;
+		histogramObj["buckets"] = bucketsObj;
+		histogramObj["sum"] = it.value().sum;
+		histogramObj["count"] = static_cast<double>(it.value().count);
+		histogramsObj[it.key()] = histogramObj;
+	}
+
+	QJsonObject outerObj;
+	outerObj["job"] = _jobName;
+	outerObj["success"] = _success;
+	outerObj["finished"] = _finishedAt;
+	outerObj["durationSeconds"] = _jobMs / 1000.0;
+	outerObj["phaseSeconds"] = phasesObj;
+	outerObj["counters"] = countersObj;
+	outerObj["gauges"] = gaugesObj;
+	outerObj["histograms"] = histogramsObj;
+	return QJsonDocument(outerObj).toJson();
+}
+
+QByteArray
+SyncMetrics::toPrometheus() const
+{
+	QMutexLocker locker(&mutex);
+
+	QString out;
+	QString jobLabel = QString("job=\"%1\"").arg(_jobName);
+
+	out += "# TYPE wique_job_success gauge\n";
+	out += QString("wique_job_success{%1} %2\n").arg(jobLabel).arg(_success ? 1 : 0);
+	out += "# TYPE wique_job_duration_seconds gauge\n";
+	out += QString("wique_job_duration_seconds{%1} %2\n").arg(jobLabel).arg(_jobMs / 1000.0);
+	out += "# TYPE wique_job_finished_timestamp_seconds gauge\n";
+	out += QString("wique_job_finished_timestamp_seconds{%1} %2\n").arg(jobLabel)
+			.arg(QDateTime::fromString(_finishedAt, Qt::ISODate).toSecsSinceEpoch());
+
+	out += "# TYPE wique_phase_duration_seconds gauge\n";
+	for (auto it = phaseMs.constBegin(); it != phaseMs.constEnd(); ++it)
+		out += QString("wique_phase_duration_seconds{%1,phase=\"%2\"} %3\n").arg(jobLabel, it.key()).arg(it.value() / 1000.0);
+
+	for (auto it = counters.constBegin(); it != counters.constEnd(); ++it)
+	{
+		QString name = metricPrefix + it.key() + "_total";
+		out += QString("# TYPE %1 counter\n").arg(name);
+		out += QString("%1{%2} %3\n").arg(name, jobLabel).arg(it.value());
+	}
+
+	for (auto it = gauges.constBegin(); it != gauges.constEnd(); ++it)
+	{
+		QString name = metricPrefix + it.key();
+		out += QString("# TYPE %1 gauge\n").arg(name);
+		out += QString("%1{%2} %3\n").arg(name, jobLabel).arg(it.value());
+	}
+
+	for (auto it = histograms.constBegin(); it != histograms.constEnd(); ++it)
+	{
+		QString name = metricPrefix + it.key();
+		out += QString("# TYPE %1 histogram\n").arg(name);
+
+		qint64 cumulative = 0;
+		for (int i = 0; i < bucketBounds.count(); ++i)
+		{
+			cumulative += it.value().bucketCounts[i];
+			out += QString("%1_bucket{%2,le=\"%3\"} %4\n").arg(name, jobLabel, formatBound(bucketBounds[i])).arg(cumulative);
+		}
+		out += QString("%1_bucket{%2,le=\"+Inf\"} %3\n").arg(name, jobLabel).arg(it.value().count);
+		out += QString("%1_sum{%2} %3\n").arg(name, jobLabel).arg(it.value().sum);
+		out += QString("%1_count{%2} %3\n").arg(name, jobLabel).arg(it.value().count);
+	}
+
+	return out.toUtf8();
+}
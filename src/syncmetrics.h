@@ -0,0 +1,70 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+// Measurements of one job (refresh, rescan or export), for monitoring.
+//
+// Phases are timed between beginPhase() and endPhase(). Counters only go up,
+// while gauges hold the last value set.
+// Histograms count observations (e.g. latencies in ms) in fixed buckets, the
+// way Prometheus does. The lot can be written out as JSON or in Prometheus'
+// text format once the job is over.
+//
+// Thread-safe, since Database's workers report from their own threads.
+class SyncMetrics
+{
+public:
+	SyncMetrics();
+
+	// Forgets everything, and starts timing a new job
+	void beginJob(const QString& jobName);
+	void endJob(bool success);
+
+	void beginPhase(const QString& phase);
+	void endPhase(const QString& phase);
+
+	void add(const QString& counter, qint64 amount = 1);
+	void setGauge(const QString& gauge, double value);
+	void observe(const QString& histogram, double value);
+
+	qint64 counter(const QString& counter) const;
+	qint64 phaseMilliseconds(const QString& phase) const;
+
+	// Written as JSON, unless the file name ends in ".prom" or ".txt"
+	bool writeTo(const QString& filePath) const;
+
+	QByteArray toJson() const;
+	QByteArray toPrometheus() const;
+
+private:
+	struct Histogram
+	{
+		QVector<qint64> bucketCounts; // Same length as bucketBounds, plus one for +Inf
+		double sum;
+		qint64 count;
+	};
+
+	mutable QMutex mutex;
+
+	QString _jobName;
+	bool _success;
+	QString _finishedAt;
+	QElapsedTimer _jobTimer;
+	qint64 _jobMs;
+
+	QMap<QString, QElapsedTimer> runningPhases;
+	QMap<QString, qint64> phaseMs;
+	QMap<QString, qint64> counters;
+	QMap<QString, double> gauges;
+	QMap<QString, Histogram> histograms;
+};
+
+#endif // SYNCMETRICS_H
@@ -0,0 +1,338 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "wikilinks.h"
+
+#include <QJsonArray>
+
+#include <algorithm>
+
+// Without siteinfo: "#REDIRECT" in the languages that MediaWiki translates it to most often
+static const QStringList defaultRedirectWords{
+		"REDIRECTION",      // fr
+		"REDIRECT",         // en (all wikis understand it)
+		"WEITERLEITUNG",    // de
+		"REDIRECCIÓN",      // es
+		"RINVIA",           // it
+		"DOORVERWIJZING",   // nl
+		"PATRZ",            // pl
+		"REDIRECIONAMENTO", // pt
+		"ПЕРЕНАПРАВЛЕНИЕ",  // ru
+		"PŘESMĚRUJ",        // cs
+		"OMDIRIGERING",     // sv, no
+		"UUDELLEENOHJAUS",  // fi
+		"YÖNLENDİRME",      // tr
+		"転送",             // ja
+		"重定向",           // zh
+		"넘겨주기"          // ko
+};
+
+// Without siteinfo: Lower-case name -> Canonical name of the namespaces that every wiki has
+static const QHash<QString, QString> canonicalNamespaces{
+		{"media", "Media"},
+		{"special", "Special"},
+		{"talk", "Talk"},
+		{"user", "User"},
+		{"user talk", "User talk"},
+		{"project", "Project"},
+		{"project talk", "Project talk"},
+		{"file", "File"},
+		{"file talk", "File talk"},
+		{"image", "File"},
+		{"image talk", "File talk"},
+		{"mediawiki", "MediaWiki"},
+		{"mediawiki talk", "MediaWiki talk"},
+		{"template", "Template"},
+		{"template talk", "Template talk"},
+		{"help", "Help"},
+		{"help talk", "Help talk"},
+		{"category", "Category"},
+		{"category talk", "Category talk"}
+};
+
+static void
+capitalizeFirstLetter(QString& title, int pos)
+{
+	// NOTE: Letters outside the BMP are left alone
+	if (pos < title.size() && !title[pos].isSurrogate())
+		title[pos] = title[pos].toUpper();
+}
+
+static int
+skipSpaces(const ushort* data, int pos, int length)
+{
+	while (pos < length && QChar::isSpace(data[pos]))
+		++pos;
+	return pos;
+}
+
+static void
+sortLongestFirst(QStringList& words)
+{
+	std::stable_sort(words.begin(), words.end(), [](const QString& a, const QString& b)
+	{
+		return a.size() > b.size();
+	});
+}
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+WikiLinks::WikiLinks() :
+	redirectWords(defaultRedirectWords),
+	redirectCase(Qt::CaseInsensitive),
+	namespaceNames(canonicalNamespaces),
+	categoryPrefix("Category:")
+{
+	sortLongestFirst(redirectWords);
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+WikiLinks
+WikiLinks::fromSiteInfo(const QJsonObject& siteInfo)
+{
+	WikiLinks wikiLinks;
+
+	// Every alias of the redirect magic word, e.g. "#REDIRECT" and "#WEITERLEITUNG" on German wikis
+	for (const QJsonValue& value : siteInfo["magicwords"].toArray())
+	{
+		auto magicWordObj = value.toObject();
+		if (magicWordObj["name"].toString() != "redirect")
+			continue;
+
+		QStringList words;
+		for (const QJsonValue& alias : magicWordObj["aliases"].toArray())
+		{
+			QString word = alias.toString();
+			if (word.startsWith(QLatin1Char('#')))
+				word = word.mid(1);
+			if (!word.isEmpty())
+				words << word;
+		}
+		if (!words.isEmpty())
+		{
+			sortLongestFirst(words);
+			wikiLinks.redirectWords = words;
+			// NOTE: The flag is an empty string when set, and missing otherwise
+			wikiLinks.redirectCase = magicWordObj.contains("case-sensitive") ? Qt::CaseSensitive : Qt::CaseInsensitive;
+		}
+	}
+
+	// Titles use the local names (e.g. "Datei:"), but links may use those, the
+	// canonical names ("File:") or the aliases ("Bild:", "Image:")
+	auto namespacesObj = siteInfo["namespaces"].toObject();
+	if (!namespacesObj.isEmpty())
+	{
+		QHash<int, QString> localNames;
+		wikiLinks.namespaceNames.clear();
+		for (auto it = namespacesObj.constBegin(); it != namespacesObj.constEnd(); ++it)
+		{
+			auto namespaceObj = it.value().toObject();
+			QString name = namespaceObj["*"].toString();
+			localNames[namespaceObj["id"].toInt()] = name;
+			if (namespaceObj["case"].toString() == "case-sensitive")
+				wikiLinks.caseSensitiveNamespaces.insert(name);
+			if (name.isEmpty())
+				continue;
+
+			wikiLinks.namespaceNames[name.toLower()] = name;
+			QString canonical = namespaceObj["canonical"].toString();
+			if (!canonical.isEmpty())
+				wikiLinks.namespaceNames[canonical.toLower()] = name;
+		}
+		for (const QJsonValue& value : siteInfo["namespacealiases"].toArray())
+		{
+			auto aliasObj = value.toObject();
+			QString name = localNames.value(aliasObj["id"].toInt(-1));
+			if (!name.isEmpty())
+				wikiLinks.namespaceNames[aliasObj["*"].toString().toLower()] = name;
+		}
+		if (!localNames.value(14).isEmpty())
+			wikiLinks.categoryPrefix = localNames[14] + QLatin1Char(':');
+	}
+
+	// Older wikis only state the case rule of the main namespace here
+	if (siteInfo["general"].toObject()["case"].toString() == "case-sensitive")
+		wikiLinks.caseSensitiveNamespaces.insert(QString());
+
+	return wikiLinks;
+}
+
+QString
+WikiLinks::redirectTarget(const QString& wikiText) const
+{
+	const ushort* data = wikiText.utf16();
+	const int length = wikiText.size();
+
+	// MediaWiki: ^\s*#REDIRECT\s*:?\s*\[\[
+	int pos = skipSpaces(data, 0, length);
+	if (pos >= length || data[pos] != '#')
+		return QString();
+	++pos;
+
+	QStringView rest = QStringView(wikiText).mid(pos);
+	int wordLength = -1;
+	for (const QString& word : redirectWords)
+	{
+		if (rest.startsWith(QStringView(word), redirectCase))
+		{
+			wordLength = word.size();
+			break;
+		}
+	}
+	if (wordLength == -1)
+		return QString();
+
+	pos = skipSpaces(data, pos + wordLength, length);
+	if (pos < length && data[pos] == ':')
+		pos = skipSpaces(data, pos + 1, length);
+	if (pos + 1 >= length || data[pos] != '[' || data[pos + 1] != '[')
+		return QString();
+
+	QStringView target;
+	int endPos;
+	if (!readLink(wikiText, pos, target, endPos))
+		return QString();
+	return normalizeTitle(target);
+}
+
+QStringList
+WikiLinks::links(const QString& wikiText) const
+{
+	const ushort* data = wikiText.utf16();
+	const int length = wikiText.size();
+
+	QStringList result;
+	QSet<QString> seen;
+	int pos = 0;
+	while ((pos = wikiText.indexOf(QLatin1Char('['), pos)) != -1)
+	{
+		if (pos + 1 >= length)
+			break;
+		if (data[pos + 1] != '[')
+		{
+			pos += 2;
+			continue;
+		}
+
+		QStringView target;
+		bool found = readLink(wikiText, pos, target, pos);
+		if (!found)
+			continue;
+
+		target = target.trimmed();
+		bool leadingColon = target.startsWith(QLatin1Char(':'));
+		QString title = normalizeTitle(target);
+
+		// Empty titles are links to a section of the same page
+		if (title.isEmpty() || seen.contains(title))
+			continue;
+		if (!leadingColon && title.startsWith(categoryPrefix))
+			continue;
+
+		seen.insert(title);
+		result << title;
+	}
+	return result;
+}
+
+QString
+WikiLinks::normalizeTitle(QStringView link) const
+{
+	link = link.trimmed();
+	if (link.startsWith(QLatin1Char(':')))
+		link = link.mid(1);
+
+	// Underscores and runs of whitespace become single spaces. None are left at either end.
+	QString title;
+	title.reserve(link.size());
+	bool pendingSpace = false;
+	for (QChar c : link)
+	{
+		if (c == QLatin1Char('_') || c.isSpace())
+		{
+			pendingSpace = !title.isEmpty();
+			continue;
+		}
+		if (pendingSpace)
+		{
+			title += QLatin1Char(' ');
+			pendingSpace = false;
+		}
+		title += c;
+	}
+
+	// Namespace names are case-insensitive. Titles usually only have their first letter case-insensitive.
+	int colon = title.indexOf(QLatin1Char(':'));
+	if (colon > 0)
+	{
+		QString prefix = title.left(colon).trimmed().toLower();
+		auto it = namespaceNames.constFind(prefix);
+		if (it != namespaceNames.constEnd())
+		{
+			title = it.value() + QLatin1Char(':') + title.mid(colon + 1).trimmed();
+			if (!caseSensitiveNamespaces.contains(it.value()))
+				capitalizeFirstLetter(title, it.value().size() + 1);
+			return title;
+		}
+	}
+	if (!caseSensitiveNamespaces.contains(QString()))
+		capitalizeFirstLetter(title, 0);
+	return title;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+bool
+WikiLinks::readLink(const QString& wikiText, int openPos, QStringView& target, int& endPos)
+{
+	const ushort* data = wikiText.utf16();
+	const int length = wikiText.size();
+
+	// "[[[X]]]" is a '[' followed by a link
+	int start = openPos + 2;
+	while (start < length && data[start] == '[')
+		++start;
+
+	// The target ends at the section, the label or the closing brackets.
+	// Characters that can't be in a title mean that this isn't a link at all.
+	int pos = start;
+	for (; pos < length; ++pos)
+	{
+		ushort c = data[pos];
+		if (c == '|' || c == '#' || c == ']')
+			break;
+		if (c == '[' || c == '\n' || c == '{' || c == '}' || c == '<' || c == '>')
+		{
+			endPos = pos;
+			return false;
+		}
+	}
+	if (pos >= length)
+	{
+		endPos = length;
+		return false;
+	}
+	target = QStringView(wikiText.constData() + start, pos - start);
+
+	// Skip the section and the label. A link inside a link (e.g. in an image caption)
+	// makes the outer one invalid, but the inner one is picked up from endPos.
+	for (; pos < length && data[pos] != ']'; ++pos)
+	{
+		if (data[pos] == '[')
+		{
+			endPos = pos;
+			return false;
+		}
+	}
+	if (pos + 1 >= length || data[pos + 1] != ']')
+	{
+		endPos = pos + 1;
+		return false;
+	}
+	endPos = pos + 2;
+	return true;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef WIKILINKS_H
+#define WIKILINKS_H
+
+#include <QHash>
+#include <QJsonObject>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QStringView>
+
+// Finds wikilinks in wikitext, without regular expressions.
+//
+// The text is scanned once. QString::indexOf() (which is vectorized) skips
+// ahead to the next '[', and only the characters of each link are looked at
+// one by one.
+//
+// Link targets are normalized the way the wiki normalizes titles, so that
+// they can be compared with the titles in the database. What counts as a
+// redirect, the namespace names and the case rules differ from wiki to wiki,
+// so they are taken from the wiki's siteinfo (see fromSiteInfo()).
+//
+// Reentrant: a WikiLinks may be copied to, and used in, several threads at once.
+class WikiLinks
+{
+public:
+	// Without the wiki's siteinfo: the most common translations of "#REDIRECT",
+	// the canonical (English) namespace names, and first-letter case everywhere.
+	WikiLinks();
+
+	// The "query" object of the reply to
+	// action=query&meta=siteinfo&siprop=general|namespaces|namespacealiases|magicwords
+	// Whatever is missing from it falls back to the defaults.
+	static WikiLinks fromSiteInfo(const QJsonObject& siteInfo);
+
+	// The title that a redirect page points to, or an empty string if the page
+	// isn't a redirect
+	QString redirectTarget(const QString& wikiText) const;
+
+	// Every page linked to from the text, in order of first appearance, without duplicates.
+	// Category tags ("[[Category:X]]") put the page in a category, so they don't count as links.
+	QStringList links(const QString& wikiText) const;
+
+	// "_" -> " ", extra spaces removed, leading ":" dropped, namespace names and
+	// aliases replaced by the names that the wiki uses in titles, and the first
+	// letter in upper case (unless the namespace is case-sensitive).
+	QString normalizeTitle(QStringView link) const;
+
+private:
+	// Reads the link that opens at text[openPos] ("[["). On success, returns
+	// true, and sets target to the raw target (without section or label) and
+	// endPos to the position after the closing "]]". Otherwise, endPos is where
+	// scanning may resume.
+	static bool readLink(const QString& wikiText, int openPos, QStringView& target, int& endPos);
+
+	QStringList redirectWords; // Without the '#'. Longest first, so that no word hides a longer one.
+	Qt::CaseSensitivity redirectCase;
+	QHash<QString, QString> namespaceNames; // Lower-case name or alias -> Name used in titles
+	QSet<QString> caseSensitiveNamespaces;  // Names used in titles. "" = The main namespace.
+	QString categoryPrefix;                 // "Category:" in the wiki's language
+};
+
+#endif // WIKILINKS_H
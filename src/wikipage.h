@@ -0,0 +1,18 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef WIKIPAGE_H
+#define WIKIPAGE_H
+
+#include <QString>
+
+// One downloaded page, as handed from WikiQuerier to Database
+struct WikiPage
+{
+	int id;
+	QString title;
+	QString touched;
+	QString content;
+};
+
+#endif // WIKIPAGE_H
@@ -2,28 +2,189 @@
 // This code is licensed under the MIT license (see LICENSE.MIT for details)
 
 #include "wikiquerier.h"
+#include "jsonstreamreader.h"
 
-#include <QNetworkAccessManager>
-#include <QNetworkCookieJar>
-#include <QNetworkCookie>
-#include <QNetworkReply>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QUrlQuery>
 
+#include <algorithm>
+
+#include <QDebug>
+
 // TODO: Extract error messages from MediaWiki replies (e.g. if querying fails)
 
-// TODO: Allow user-configurable URL
-static const QString apiUrl = "http://wiki.qt.io/api.php";
+// QNetworkAccessManager opens at most 6 parallel HTTP/1.1 connections per host.
+// A bigger window would only queue up inside QNAM.
+// NOTE: Over HTTP/2 there is only one connection, but the server still has to do the work.
+static const int maxRequestsPerHost = 6;
+
+// Pages per text request. Non-bots may ask for at most 50 pages' content at a time.
+static const int initialTextChunkSize = 10;
+static const int maxTextChunkSize = 50;
+
+// Text chunks shrink when replies are slower or bigger than this, and grow when well under
+static const int targetReplyMs = 3000;
+static const int maxReplySize = 4 * 1024 * 1024;
+
+// Failed chunks (after the transport's retries) that mean the server is not coming back
+static const int maxConsecutiveChunkFailures = 3;
+
+// Namespaces below 0 (Special, Media) hold no pages of their own
+static bool
+isListableNamespace(int namespaceId)
+{
+	return namespaceId >= 0;
+}
+
+// Odd IDs are talk pages
+static bool
+isSubjectNamespace(int namespaceId)
+{
+	return isListableNamespace(namespaceId) && namespaceId % 2 == 0;
+}
+
+// Picks the page records out of a prop=info|revisions reply while it streams in,
+// without building a document first:
+// {"query": {"pages": {"<id>": {"pageid": ..., "title": ..., "touched": ..., "revisions": [{"*": <text>}]}}}}
+class PageRecordStream : public ReplyStream, private JsonStreamReader::Handler
+{
+public:
+	PageRecordStream() :
+		reader(this)
+	{ restart(); }
+
+	// Receives the pages if the reply was complete. They may be swapped out.
+	std::function<void(bool ok, QVector<WikiPage>& pages, int replySize, qint64 latencyMs)> onFinished;
+
+	// For error messages
+	QByteArray replyHead() const
+	{ return head; }
+
+	// Pages that the wiki says don't exist (any more), as opposed to pages left out of the reply
+	const QSet<int>& goneIds() const
+	{ return gone; }
+
+	void restart() override
+	{
+		reader.reset();
+		pages.clear();
+		gone.clear();
+		head.clear();
+		replySize = 0;
+		hasQuery = false;
+	}
+
+	void append(const QByteArray& piece) override
+	{
+		replySize += piece.size();
+		if (head.size() < replyHeadSize)
+			head += piece.left(replyHeadSize - head.size());
+
+		reader.feed(piece);
+	}
+
+	void finish(bool ok, qint64 latencyMs) override
+	{
+		bool complete = ok && reader.isFinished() && hasQuery;
+		onFinished(complete, pages, replySize, latencyMs);
+	}
+
+private:
+	static const int replyHeadSize = 512;
+
+	// Whether the innermost open container (or the current value) is inside query.pages.<id>
+	static bool isInPage(const JsonStreamReader& r)
+	{ return r.depth() >= 4 && r.keyAt(0) == "query" && r.keyAt(1) == "pages"; }
+
+	void beginContainer(const JsonStreamReader& r) override
+	{
+		if (r.depth() == 2 && r.keyAt(0) == "query")
+			hasQuery = true;
+		else if (r.depth() == 4 && isInPage(r))
+		{
+			current = WikiPage();
+			hasRevision = false;
+			isMissing = false;
+		}
+	}
+
+	void endContainer(const JsonStreamReader& r) override
+	{
+		if (r.depth() != 4 || !isInPage(r))
+			return;
+
+		if (isMissing)
+		{
+			gone.insert(current.id);
+			return;
+		}
+		if (!hasRevision)
+		{
+			// e.g. the reply hit $wgAPIMaxResultSize. The caller treats the page as not downloaded.
+			qWarning() << "ERROR: WikiQuerier: No text for page" << current.id << "in the reply";
+			return;
+		}
+		pages << current;
+		current = WikiPage();
+	}
+
+	void scalar(const JsonStreamReader& r, const QJsonValue& value) override
+	{
+		// Older wikis list unknown IDs in query.badpageids instead of marking them as missing
+		if (r.depth() == 3 && r.keyAt(0) == "query" && r.keyAt(1) == "badpageids")
+		{
+			gone.insert(value.toInt());
+			return;
+		}
+		if (!isInPage(r))
+			return;
+
+		if (r.depth() == 4)
+		{
+			const QString& key = r.keyAt(3);
+			if (key == "pageid")
+				current.id = value.toInt();
+			else if (key == "title")
+				current.title = value.toString();
+			else if (key == "touched")
+				current.touched = value.toString();
+			else if (key == "missing" || key == "invalid")
+				isMissing = true;
+		}
+		else if (r.depth() == 6 && r.keyAt(3) == "revisions" && r.indexAt(4) == 0 && r.keyAt(5) == "*")
+		{
+			current.content = value.toString();
+			hasRevision = true;
+		}
+	}
+
+	JsonStreamReader reader;
+	QVector<WikiPage> pages;
+	QSet<int> gone;
+	WikiPage current;
+	bool hasRevision;
+	bool isMissing;
+	bool hasQuery;
+	QByteArray head;
+	int replySize;
+};
 
 /**********************************************************************\
  * CONSTRUCTOR/DESTRUCTOR
 \**********************************************************************/
 WikiQuerier::WikiQuerier(QObject* parent) :
 	QObject(parent),
-	nam(nullptr),
+	transport(new WikiTransport(this)),
+	_metrics(nullptr),
 	isBusy(false),
-	_lastOpWasCompleted(false)
+	_lastOpWasCompleted(false),
+	namespacesKnown(false),
+	_maxConcurrentRequests(4),
+	requestsInFlight(0),
+	chunkFailed(false),
+	listingFailed(false)
 {
 }
 
@@ -31,7 +192,36 @@ WikiQuerier::WikiQuerier(QObject* parent) :
  * PUBLIC
 \**********************************************************************/
 void
-WikiQuerier::queryPageList()
+WikiQuerier::setApiUrl(const QUrl& url)
+{
+	transport->setApiUrl(url);
+	namespacesKnown = false;
+}
+
+void
+WikiQuerier::setIncludedNamespaces(const QVector<int>& namespaceIds)
+{
+	_includedNamespaces = namespaceIds;
+	namespacesKnown = false;
+}
+
+void
+WikiQuerier::queryNamespaces()
+{
+	withNamespaces([=](bool ok)
+	{
+		emit namespacesFetched(ok);
+	});
+}
+
+void
+WikiQuerier::setMaxConcurrentRequests(int count)
+{
+	_maxConcurrentRequests = qBound(1, count, maxRequestsPerHost);
+}
+
+void
+WikiQuerier::queryLatestChange()
 {
 	if (isBusy)
 	{
@@ -41,13 +231,35 @@ WikiQuerier::queryPageList()
 
 	isBusy = true;
 	_lastOpWasCompleted = false;
-	namespaceListIdx = 0;
-	_tmp_allIds.clear();
-	fetchPageListChunk();
+
+	QUrlQuery query;
+	query.addQueryItem("format",  "json");
+	query.addQueryItem("action",  "query");
+	query.addQueryItem("list",    "recentchanges");
+	query.addQueryItem("rcprop",  "timestamp");
+	query.addQueryItem("rclimit", "1");
+
+	transport->get(query, [=](const QByteArray& body)
+	{
+		auto outerObj = QJsonDocument::fromJson(body).object();
+		isBusy = false;
+
+		if (!outerObj.contains("query"))
+		{
+			qDebug() << "ERROR: WikiQuerier: Query failed. Raw reply is" << outerObj;
+			emit latestChangeFetched(QString());
+			return;
+		}
+
+		auto changes = outerObj["query"].toObject()["recentchanges"].toArray();
+		QString timestamp = changes.isEmpty() ? QString() : changes[0].toObject()["timestamp"].toString();
+		_lastOpWasCompleted = true;
+		emit latestChangeFetched(timestamp);
+	});
 }
 
 void
-WikiQuerier::queryLastModified(const QVector<int>& pageIds)
+WikiQuerier::queryRecentChanges(const QString& since)
 {
 	if (isBusy)
 	{
@@ -57,20 +269,94 @@ WikiQuerier::queryLastModified(const QVector<int>& pageIds)
 
 	isBusy = true;
 	_lastOpWasCompleted = false;
-	idChunkIdx = 0;
-	_tmp_allIds_chunked.clear();
-	_tmp_allTimestamps.clear();
+	_tmp_rcSince = since;
+	_tmp_rcLatest = since;
+	_tmp_rcChangedIds.clear();
+	_tmp_rcDeletedTitles.clear();
+	_tmp_rcTitles_chunked.clear();
+
+	// Only changes in the mirrored namespaces count
+	withNamespaces([=](bool ok)
+	{
+		if (ok)
+			fetchRecentChangesChunk();
+		else
+			finalizeRecentChanges();
+	});
+}
 
-	if (pageIds.isEmpty())
+void
+WikiQuerier::queryPageList(const QString& resumePoint)
+{
+	if (isBusy)
 	{
-		finalizeTimestamps();
+		qDebug() << "ERROR: WikiQuerier is busy.";
 		return;
 	}
 
-	qDebug() << "(4) Fetching page timestamps...";
-	for (int i = 0; i < pageIds.count(); i += 50)
-		_tmp_allIds_chunked << pageIds.mid(i, 50);
-	fetchTimestampChunk(_tmp_allIds_chunked[0]);
+	isBusy = true;
+	_lastOpWasCompleted = false;
+	listingFailed = false;
+	requestsInFlight = 0;
+	_tmp_allIds.clear();
+	_tmp_nsQueue.clear();
+	_tmp_nsContinuations.clear();
+	_tmp_nsDone.clear();
+
+	withNamespaces([=](bool ok)
+	{
+		if (!ok)
+		{
+			finalizePageLists();
+			return;
+		}
+
+		// Pick up where an earlier listing left off (see listingResumePoint())
+		QMap<int, QMap<QString, QString>> continuations;
+		if (!resumePoint.isEmpty())
+		{
+			auto resumeObj = QJsonDocument::fromJson(resumePoint.toUtf8()).object();
+			if (!resumeObj.contains("done"))
+				qDebug() << "ERROR: WikiQuerier: Can't resume listing from" << resumePoint << "- starting over";
+			else
+			{
+				for (const QJsonValue& value : resumeObj["done"].toArray())
+					_tmp_nsDone << value.toInt();
+
+				auto continueObj = resumeObj["continue"].toObject();
+				for (auto it = continueObj.constBegin(); it != continueObj.constEnd(); ++it)
+				{
+					auto contObj = it.value().toObject();
+					for (auto jt = contObj.constBegin(); jt != contObj.constEnd(); ++jt)
+						continuations[it.key().toInt()][jt.key()] = jt.value().toString();
+				}
+			}
+		}
+
+		// Namespaces that were already being listed go first
+		for (int namespaceId : _namespaces)
+		{
+			if (_tmp_nsDone.contains(namespaceId))
+				continue;
+			if (continuations.contains(namespaceId))
+				_tmp_nsQueue.prepend(namespaceId);
+			else
+				_tmp_nsQueue << namespaceId;
+		}
+		if (_tmp_nsQueue.isEmpty())
+		{
+			_lastOpWasCompleted = true;
+			finalizePageLists();
+			return;
+		}
+
+		// Each namespace is walked on its own, with its own continuation, several at a time
+		while (requestsInFlight < _maxConcurrentRequests && !_tmp_nsQueue.isEmpty())
+		{
+			int namespaceId = _tmp_nsQueue.takeFirst();
+			fetchPageListChunk(namespaceId, continuations.value(namespaceId));
+		}
+	});
 }
 
 void
@@ -85,232 +371,497 @@ WikiQuerier::downloadPages(const QVector<int>& pageIds)
 
 	isBusy = true;
 	_lastOpWasCompleted = false;
+	chunkFailed = false;
+	textQueuePos = 0;
+	textChunkSize = initialTextChunkSize;
 	textChunkIdx = 0;
-	_tmp_texts_chunked.clear();
-	_tmp_texts = QJsonArray();
+	textChunksEmitted = 0;
+	consecutiveChunkFailures = 0;
+	_tmp_texts_queue = pageIds;
+	_tmp_texts_failed.clear();
+	_tmp_texts_received.clear();
 
 	if (pageIds.isEmpty())
 	{
 		finalizeWikiText();
 		return;
 	}
-	for (int i = 0; i < pageIds.count(); i += 50)
-		_tmp_texts_chunked << pageIds.mid(i, 50);
-	fetchTextChunk(_tmp_texts_chunked[0]);
+	dispatchTextChunks();
 }
 
 /**********************************************************************\
  * PRIVATE
 \**********************************************************************/
-static QVector<int>
-namespaceIdList{
-	0,  // Base
-	4,  // Project (Qt Wiki)
-	12, // Help
-	14  // Category
-};
+// Returns the parameters needed to fetch the next part of a listing, or an empty map if there is none.
+// Newer MediaWiki versions use "continue"; older ones use "query-continue".
+static QMap<QString, QString>
+continuationOf(const QJsonObject& outerObj, const QString& module)
+{
+	QMap<QString, QString> params;
+	QJsonObject contObj = outerObj.contains("continue")
+			? outerObj["continue"].toObject()
+			: outerObj["query-continue"].toObject()[module].toObject();
+	for (auto it = contObj.constBegin(); it != contObj.constEnd(); ++it)
+		params[it.key()] = it.value().isString() ? it.value().toString() : QString::number(it.value().toInt());
+	return params;
+}
 
 void
-WikiQuerier::fetchPageListChunk(int namespaceId, const QString& apcontinue)
+WikiQuerier::fetchRecentChangesChunk(const QMap<QString, QString>& continuation)
 {
+	QStringList namespaceStrings;
+	for (int namespaceId : _namespaces)
+		namespaceStrings << QString::number(namespaceId);
+
 	QUrlQuery query;
 	query.addQueryItem("format",      "json");
 	query.addQueryItem("action",      "query");
-	query.addQueryItem("list",        "allpages");
-	query.addQueryItem("apnamespace", QString::number(namespaceId));
-	query.addQueryItem("aplimit",     "500"); // Non-bots that query using pageid/title are limited to 500 pages at a time
-	if (!apcontinue.isEmpty())
-		query.addQueryItem("apfrom", apcontinue.toUtf8().toPercentEncoding());
-
-	QUrl fullUrl(apiUrl);
-	fullUrl.setQuery(query);
-	QNetworkRequest netRequest(fullUrl);
-	netRequest.setRawHeader("User-Agent", "Wique 0.5");
-//	netRequest.setHeader(  QNetworkRequest::CookieHeader, qVariantFromValue( nam->cookieJar()->cookiesForUrl(fullUrl) )  );
-
-	QNetworkReply* reply = nam->get(netRequest);
-	connect(reply, &QNetworkReply::finished, [=]
+	query.addQueryItem("list",        "recentchanges");
+	query.addQueryItem("rcdir",       "newer"); // Oldest first, so that later events override earlier ones
+	query.addQueryItem("rcstart",     _tmp_rcSince);
+	query.addQueryItem("rcnamespace", namespaceStrings.join('|'));
+	query.addQueryItem("rctype",      "edit|new|log");
+	query.addQueryItem("rcprop",      "ids|title|timestamp|loginfo");
+	query.addQueryItem("rclimit",     "500");
+	for (auto it = continuation.constBegin(); it != continuation.constEnd(); ++it)
+		query.addQueryItem(it.key(), QUrl::toPercentEncoding(it.value()));
+
+	transport->get(query, [=](const QByteArray& body)
 	{
-		auto outerObj = QJsonDocument::fromJson(reply->readAll()).object();
-		reply->deleteLater();
+		auto outerObj = QJsonDocument::fromJson(body).object();
 
-		qDebug() << "\t1 page list chunk obtained";
+		qDebug() << "\t1 recent changes chunk obtained";
 
 		if (!outerObj.contains("query"))
 		{
 			qDebug() << "ERROR: WikiQuerier: Query failed. Raw reply is" << outerObj;
-			finalizePageLists();
+			finalizeRecentChanges();
 			return;
 		}
 
-		bool continuingHere = outerObj.contains("query-continue");
-		bool continuingNext = true;
-		if (continuingHere)
+		// Kick off the next set of downloads
+		auto next = continuationOf(outerObj, "recentchanges");
+		if (!next.isEmpty())
+			fetchRecentChangesChunk(next);
+
+		// Actual processing
+		QStringList titlesToLookUp;
+		for (const QJsonValue& val : outerObj["query"].toObject()["recentchanges"].toArray())
 		{
-			// Kick off the next set of downloads
-			QString next = outerObj["query-continue"].toObject()["allpages"].toObject()["apcontinue"].toString();
-			fetchPageListChunk(namespaceIdList[namespaceListIdx], next);
+			auto changeObj = val.toObject();
+			int pageId = changeObj["pageid"].toInt();
+			QString title = changeObj["title"].toString();
+			QString logType = changeObj["logtype"].toString();
+			QString logAction = changeObj["logaction"].toString();
+			_tmp_rcLatest = qMax(_tmp_rcLatest, changeObj["timestamp"].toString());
+
+			// NOTE: The title might have been re-created since, as a different page
+			if (logType == "delete" && logAction == "delete")
+			{
+				_tmp_rcDeletedTitles << title;
+				continue;
+			}
+
+			if (pageId > 0)
+				_tmp_rcChangedIds << pageId;
+			else
+				titlesToLookUp << title; // e.g. Restored pages
+
+			// A move normally leaves a new redirect page behind at the old title
+			if (logType == "move" && !changeObj["logparams"].toObject().contains("suppressredirect"))
+				titlesToLookUp << title;
 		}
-		else
+		for (int i = 0; i < titlesToLookUp.count(); i += 50)
+			_tmp_rcTitles_chunked << titlesToLookUp.mid(i, 50);
+
+		if (next.isEmpty())
 		{
-			// Kick off the next set of downloads
-			continuingNext = ++namespaceListIdx < namespaceIdList.count();
-			if (continuingNext)
-				fetchPageListChunk(namespaceIdList[namespaceListIdx]);
+			if (_tmp_rcTitles_chunked.isEmpty())
+			{
+				_lastOpWasCompleted = true;
+				finalizeRecentChanges();
+			}
+			else
+				fetchIdsOfTitles(0);
 		}
+	});
+}
 
-		// Actual processing
-		auto innerArray = outerObj["query"].toObject()["allpages"].toArray();
-		for (const QJsonValue& pageObj : innerArray)
-			_tmp_allIds << pageObj.toObject()["pageid"].toInt();
+void
+WikiQuerier::fetchIdsOfTitles(int chunkIdx)
+{
+	QUrlQuery query;
+	query.addQueryItem("format", "json");
+	query.addQueryItem("action", "query");
+	query.addQueryItem("prop",   "info");
+	query.addQueryItem("titles", QUrl::toPercentEncoding(_tmp_rcTitles_chunked[chunkIdx].join('|'))); // NOTE: Limited to 50 (or 500 for bots)
 
-		if (!continuingHere && !continuingNext)
+	transport->get(query, [=](const QByteArray& body)
+	{
+		auto outerObj = QJsonDocument::fromJson(body).object();
+
+		if (!outerObj.contains("query"))
+		{
+			qDebug() << "ERROR: WikiQuerier: Query failed. Raw reply is" << outerObj;
+			finalizeRecentChanges();
+			return;
+		}
+
+		// Titles that don't exist (anymore) come back without a page ID
+		auto pagesObj = outerObj["query"].toObject()["pages"].toObject();
+		for (auto it = pagesObj.constBegin(); it != pagesObj.constEnd(); ++it)
+		{
+			int pageId = it.value().toObject()["pageid"].toInt();
+			if (pageId > 0)
+				_tmp_rcChangedIds << pageId;
+		}
+
+		if (chunkIdx + 1 < _tmp_rcTitles_chunked.count())
+			fetchIdsOfTitles(chunkIdx + 1);
+		else
 		{
-			// ASSUMPTION: The downloaded list is only ever for detailed updates
-			qDebug() << "...Found" << _tmp_allIds.count() << "pages in total.\n";
 			_lastOpWasCompleted = true;
-			finalizePageLists();
+			finalizeRecentChanges();
 		}
 	});
-	// TODO: Handle network errors
 }
 
 void
-WikiQuerier::fetchTimestampChunk(QVector<int> ids)
+WikiQuerier::withNamespaces(const std::function<void(bool ok)>& next)
 {
-	QStringList idStrings;
-	for (int id : ids)
-		idStrings << QString::number(id);
+	if (namespacesKnown)
+	{
+		next(true);
+		return;
+	}
 
+	qDebug() << "Fetching the list of namespaces...";
 
 	QUrlQuery query;
-	query.addQueryItem("format",  "json");
-	query.addQueryItem("action",  "query");
-	query.addQueryItem("prop",    "info");
-	query.addQueryItem("pageids",  idStrings.join('|')); // NOTE: Limited to 50 (or 500 for bots)
+	query.addQueryItem("format", "json");
+	query.addQueryItem("action", "query");
+	query.addQueryItem("meta",   "siteinfo");
+	query.addQueryItem("siprop", "general|namespaces|namespacealiases|magicwords");
+
+	transport->get(query, [=](const QByteArray& body)
+	{
+		auto outerObj = QJsonDocument::fromJson(body).object();
+		if (!outerObj.contains("query"))
+		{
+			qDebug() << "ERROR: WikiQuerier: Query failed. Raw reply is" << outerObj;
+			next(false);
+			return;
+		}
+
+		QMap<int, QString> namespaceNames;
+		auto namespacesObj = outerObj["query"].toObject()["namespaces"].toObject();
+		for (auto it = namespacesObj.constBegin(); it != namespacesObj.constEnd(); ++it)
+		{
+			auto namespaceObj = it.value().toObject();
+			int namespaceId = namespaceObj["id"].toInt(-1);
+			if (isListableNamespace(namespaceId))
+				namespaceNames[namespaceId] = namespaceObj["*"].toString();
+		}
+
+		// Without an include list, every namespace except the talk pages
+		_namespaces.clear();
+		if (_includedNamespaces.isEmpty())
+		{
+			for (int namespaceId : namespaceNames.keys())
+			{
+				if (isSubjectNamespace(namespaceId))
+					_namespaces << namespaceId;
+			}
+		}
+		else
+		{
+			for (int namespaceId : _includedNamespaces)
+			{
+				if (namespaceNames.contains(namespaceId))
+					_namespaces << namespaceId;
+				else
+					qDebug() << "ERROR: WikiQuerier: The wiki has no namespace" << namespaceId;
+			}
+		}
+		if (_namespaces.isEmpty())
+		{
+			qDebug() << "ERROR: WikiQuerier: None of the wiki's namespaces are included";
+			next(false);
+			return;
+		}
 
-	QUrl fullUrl(apiUrl);
-	fullUrl.setQuery(query);
-	QNetworkRequest netRequest(fullUrl);
-	netRequest.setRawHeader("User-Agent", "Wique 0.5");
-//	netRequest.setHeader(  QNetworkRequest::CookieHeader, qVariantFromValue( nam->cookieJar()->cookiesForUrl(url_query) )  );
+		QStringList descriptions;
+		for (int namespaceId : _namespaces)
+		{
+			QString name = namespaceNames[namespaceId];
+			descriptions << QString("%1 (%2)").arg(namespaceId).arg(name.isEmpty() ? "Main" : name);
+		}
+		qDebug() << "...Mirroring namespaces" << qPrintable(descriptions.join(", "));
+
+		// Only the parts that affect how wikitext is read. The rest (e.g. the server time) changes all the time.
+		auto queryObj = outerObj["query"].toObject();
+		QJsonObject siteInfo;
+		siteInfo["namespaces"] = queryObj["namespaces"];
+		siteInfo["namespacealiases"] = queryObj["namespacealiases"];
+		for (const QJsonValue& value : queryObj["magicwords"].toArray())
+		{
+			if (value.toObject()["name"].toString() == "redirect")
+				siteInfo["magicwords"] = QJsonArray{value};
+		}
+		siteInfo["general"] = QJsonObject{{"case", queryObj["general"].toObject()["case"]}};
+		emit siteInfoFetched(siteInfo);
+
+		namespacesKnown = true;
+		next(true);
+	});
+}
 
-	auto reply = nam->get(netRequest);
-	connect(reply, &QNetworkReply::finished, [=]
+void
+WikiQuerier::fetchPageListChunk(int namespaceId, const QMap<QString, QString>& continuation)
+{
+	// The allpages generator plus prop=info lists the pages and their timestamps in one go
+	QUrlQuery query;
+	query.addQueryItem("format",       "json");
+	query.addQueryItem("action",       "query");
+	query.addQueryItem("generator",    "allpages");
+	query.addQueryItem("gapnamespace", QString::number(namespaceId));
+	query.addQueryItem("gaplimit",     "500"); // Non-bots that query using pageid/title are limited to 500 pages at a time
+	query.addQueryItem("prop",         "info");
+	for (auto it = continuation.constBegin(); it != continuation.constEnd(); ++it)
+		query.addQueryItem(it.key(), QUrl::toPercentEncoding(it.value()));
+
+	// Where this namespace stands until the reply is in (see listingResumePoint())
+	_tmp_nsContinuations[namespaceId] = continuation;
+
+	++requestsInFlight;
+	transport->get(query, [=](const QByteArray& body)
 	{
-		auto outerObj = QJsonDocument::fromJson(reply->readAll()).object();
-		reply->deleteLater();
+		--requestsInFlight;
 
-		qDebug() << "\t1 timestamp chunk obtained";
+		auto outerDoc = QJsonDocument::fromJson(body);
+		auto outerObj = outerDoc.object();
 
-		if (!outerObj.contains("query"))
+		qDebug() << "\t1 page list chunk obtained for namespace" << namespaceId;
+
+		// NOTE: A namespace without any pages comes back without "query" (or as "[]" from older MediaWikis)
+		bool emptyListing = outerDoc.isArray()
+				|| (outerObj.contains("batchcomplete") && !outerObj.contains("query"));
+		if (!outerObj.contains("query") && !emptyListing)
 		{
-			qDebug() << "Query failed. Raw reply:" << outerObj;
-			finalizeTimestamps();
+			qDebug() << "ERROR: WikiQuerier: Query failed. Raw reply is" << outerObj;
+
+			// The other namespaces' chunks that are in flight still count
+			listingFailed = true;
+			if (requestsInFlight == 0)
+				finalizePageLists();
 			return;
 		}
 
-		// Kick off the next set of downloads
-		bool continuing = ++idChunkIdx < _tmp_allIds_chunked.count();
-		if (continuing)
-			fetchTimestampChunk(_tmp_allIds_chunked[idChunkIdx]);
+		// Kick off the next set of downloads, unless the listing is being abandoned
+		auto next = continuationOf(outerObj, "allpages");
+		if (next.isEmpty())
+		{
+			_tmp_nsContinuations.remove(namespaceId);
+			_tmp_nsDone << namespaceId;
+		}
+		else
+			_tmp_nsContinuations[namespaceId] = next;
+		if (!listingFailed)
+		{
+			if (!next.isEmpty())
+				fetchPageListChunk(namespaceId, next);
+			else if (!_tmp_nsQueue.isEmpty())
+				fetchPageListChunk(_tmp_nsQueue.takeFirst());
+		}
 
 		// Actual processing
-		auto innerObj = outerObj["query"].toObject()["pages"].toObject();
-		for (const QString& key : innerObj.keys())
+		QMap<int, QString> timestamps;
+		auto pagesObj = outerObj["query"].toObject()["pages"].toObject();
+		for (auto it = pagesObj.constBegin(); it != pagesObj.constEnd(); ++it)
 		{
-			auto timeStr = innerObj[key].toObject()["touched"].toString();
-			_tmp_allTimestamps[key.toInt()] = timeStr;
+			auto pageObj = it.value().toObject();
+			int pageId = pageObj["pageid"].toInt();
+			timestamps[pageId] = pageObj["touched"].toString();
+			_tmp_allIds << pageId;
 		}
 
-		if (!continuing)
+		bool finished = _tmp_nsQueue.isEmpty() && _tmp_nsContinuations.isEmpty();
+		emit pageInfoChunkFetched(timestamps, finished ? QString() : listingResumePoint());
+
+		if (requestsInFlight > 0)
+			return;
+		if (finished)
 		{
 			// ASSUMPTION: The downloaded list is only ever for detailed updates
-			qDebug() << "...Found" << _tmp_allTimestamps.count() << "timestamps in total.\n";
+			qDebug() << "...Found" << _tmp_allIds.count() << "pages in total.\n";
 			_lastOpWasCompleted = true;
-			finalizeTimestamps();
 		}
+		finalizePageLists();
 	});
-	// TODO: Handle network errors
+}
+
+QString
+WikiQuerier::listingResumePoint() const
+{
+	// {"done": [<namespace IDs>], "continue": {"<namespace ID>": {<continuation>}, ...}}
+	// Namespaces that are in neither list start from the beginning.
+	QJsonArray doneArray;
+	for (int namespaceId : _tmp_nsDone)
+		doneArray << namespaceId;
+
+	QJsonObject continueObj;
+	for (auto it = _tmp_nsContinuations.constBegin(); it != _tmp_nsContinuations.constEnd(); ++it)
+	{
+		QJsonObject contObj;
+		for (auto jt = it.value().constBegin(); jt != it.value().constEnd(); ++jt)
+			contObj[jt.key()] = jt.value();
+		continueObj[QString::number(it.key())] = contObj;
+	}
+
+	QJsonObject resumeObj;
+	resumeObj["done"] = doneArray;
+	resumeObj["continue"] = continueObj;
+	return QString::fromUtf8(QJsonDocument(resumeObj).toJson(QJsonDocument::Compact));
 }
 
 void
-WikiQuerier::fetchTextChunk(QVector<int> pageIds)
+WikiQuerier::dispatchTextChunks()
 {
-	if (pageIds.isEmpty())
-		return; // TODO: Notify that fetching is over
+	// The chunks are cut as they are sent, so that each one gets the latest chunk size
+	while (!chunkFailed
+			&& requestsInFlight < _maxConcurrentRequests
+			&& textQueuePos < _tmp_texts_queue.count())
+	{
+		auto pageIds = _tmp_texts_queue.mid(textQueuePos, textChunkSize);
+		textQueuePos += pageIds.count();
+		fetchTextChunk(textChunkIdx++, pageIds);
+	}
+}
 
+void
+WikiQuerier::fetchTextChunk(int chunkIdx, const QVector<int>& pageIds)
+{
 	QStringList idStrings;
 	for (int id : pageIds)
 		idStrings << QString::number(id);
 
 	QUrlQuery query;
 	query.addQueryItem("format",  "json");
+	query.addQueryItem("utf8",    "1"); // Non-ASCII text as-is, instead of as \uXXXX escapes
 	query.addQueryItem("action",  "query");
 	query.addQueryItem("prop",    "info|revisions");
 	query.addQueryItem("rvprop",  "content");
 	query.addQueryItem("pageids", idStrings.join('|'));
 
-	// TODO: Consider whether to process in chunks, or one page at a time
-	// DECISION: Implement chunk, do the one-page function in terms of the chunked function
-
-	// TODO: Decide how to emit signals
-
-	QUrl url(apiUrl);
-	url.setQuery(query);
-
-	QNetworkRequest netRequest(url);
-	netRequest.setRawHeader("User-Agent", "Wique 0.5");
-//	netRequest.setHeader(  QNetworkRequest::CookieHeader, qVariantFromValue( nam->cookieJar()->cookiesForUrl(url) )  );
-
-	auto reply = nam->get(netRequest);
-	connect(reply, &QNetworkReply::finished, [=]
+	++requestsInFlight;
+	auto stream = QSharedPointer<PageRecordStream>::create();
+	PageRecordStream* streamPtr = stream.data(); // The stream owns this callback
+	stream->onFinished = [=](bool ok, QVector<WikiPage>& chunkPages, int replySize, qint64 latencyMs)
 	{
-		auto outerObj = QJsonDocument::fromJson(reply->readAll()).object();
-		reply->deleteLater();
+		--requestsInFlight;
 
 		qDebug() << "\t1 text chunk obtained";
 
-		if (!outerObj.contains("query"))
+		if (!ok)
 		{
-			qDebug() << "Query failed. Raw reply:" << outerObj;
-			finalizeWikiText();
-			return;
+			// The transport has already retried. Carry on with the other chunks, unless the server seems to be gone.
+			qDebug() << "Query failed. Start of reply:" << streamPtr->replyHead();
+			if (_metrics)
+				_metrics->add("text_chunks_failed");
+			_tmp_texts_failed << pageIds;
+			_tmp_texts_received[chunkIdx] = QVector<WikiPage>(); // Don't hold up the chunks behind this one
+			flushTextChunks();
+
+			textChunkSize = qMax(1, textChunkSize / 2);
+			if (++consecutiveChunkFailures >= maxConsecutiveChunkFailures)
+			{
+				qDebug() << "ERROR: WikiQuerier: Too many failed chunks in a row. Stopping.";
+				chunkFailed = true;
+			}
+			else
+				dispatchTextChunks();
 		}
-
-		// Kick off the next set of downloads before processing local data
-		bool continuing = ++textChunkIdx < _tmp_texts_chunked.count();
-		if (continuing)
-			fetchTextChunk(_tmp_texts_chunked[textChunkIdx]);
-
-		// Actual processing
-		auto midObj = outerObj["query"].toObject()["pages"].toObject();
-		for (const QString& key : midObj.keys())
+		else
 		{
-			auto pageObj = midObj[key].toObject();
-			auto innerArray = pageObj["revisions"].toArray();
-			if (innerArray.isEmpty())
+			consecutiveChunkFailures = 0;
+
+			// Pages that were left out (e.g. because the reply grew too big) stay pending for the next refresh
+			QSet<int> receivedIds;
+			for (const WikiPage& page : chunkPages)
+				receivedIds.insert(page.id);
+			int leftOut = 0;
+			for (int id : pageIds)
 			{
-				qDebug() << "ERROR: Missing revisions";
-				continue;
+				if (!receivedIds.contains(id) && !streamPtr->goneIds().contains(id))
+				{
+					_tmp_texts_failed << id;
+					++leftOut;
+				}
+			}
+			if (leftOut > 0)
+			{
+				qWarning() << "ERROR: WikiQuerier:" << leftOut << "pages were left out of a text chunk";
+				if (_metrics)
+					_metrics->add("text_pages_left_out", leftOut);
+				textChunkSize = qMax(1, textChunkSize / 2);
+			}
+			else
+			{
+				// Retries and their backoff say nothing about how long a chunk of this size takes
+				adaptTextChunkSize(pageIds.count(), latencyMs, replySize);
+			}
+			if (_metrics)
+			{
+				_metrics->observe("text_chunk_ms", latencyMs);
+				_metrics->observe("text_chunk_pages", chunkPages.count());
+				_metrics->add("text_bytes", replySize);
 			}
 
-			QJsonObject dataObj;
-			dataObj["pageid"] = pageObj["pageid"].toInt();
-			dataObj["title"] = pageObj["title"].toString();
-			dataObj["touched"] = pageObj["touched"].toString();
-			dataObj["content"] = innerArray[0].toObject()["*"].toString();
+			// Kick off the next set of downloads before processing local data
+			dispatchTextChunks();
 
-			_tmp_texts << dataObj;
+			// The records were picked out of the reply as it arrived. Hand them over without copying.
+			_tmp_texts_received[chunkIdx].swap(chunkPages);
+			flushTextChunks();
 		}
 
-		if (!continuing)
+		// Wait for the stragglers before reporting
+		if (requestsInFlight > 0)
+			return;
+
+		if (chunkFailed || textQueuePos == _tmp_texts_queue.count())
 		{
-			_lastOpWasCompleted = true;
+			if (!_tmp_texts_failed.isEmpty())
+				qDebug() << "ERROR: WikiQuerier:" << _tmp_texts_failed.count() << "pages could not be downloaded.";
+
+			_lastOpWasCompleted = !chunkFailed && _tmp_texts_failed.isEmpty();
 			finalizeWikiText();
 		}
-	});
-	// TODO: Handle network errors
+	};
+	transport->get(query, stream);
+}
+
+void
+WikiQuerier::adaptTextChunkSize(int pageCount, qint64 elapsedMs, int replySize)
+{
+	// Only replies to chunks of the current size say anything about it
+	if (pageCount < textChunkSize)
+		return;
+
+	if (elapsedMs > targetReplyMs || replySize > maxReplySize)
+		textChunkSize = qMax(1, textChunkSize / 2);
+	else if (elapsedMs < targetReplyMs / 2 && replySize < maxReplySize / 2)
+		textChunkSize = qMin(maxTextChunkSize, textChunkSize + qMax(1, textChunkSize / 2));
+}
+
+void
+WikiQuerier::finalizeRecentChanges()
+{
+	isBusy = false;
+
+	QVector<int> changedIds = _tmp_rcChangedIds.toList().toVector();
+	std::sort(changedIds.begin(), changedIds.end());
+	emit recentChangesFetched(changedIds, _tmp_rcDeletedTitles.toList(), _tmp_rcLatest);
 }
 
 void
@@ -321,15 +872,31 @@ WikiQuerier::finalizePageLists()
 }
 
 void
-WikiQuerier::finalizeTimestamps()
+WikiQuerier::flushTextChunks()
 {
-	isBusy = false;
-	emit timestampsFetched(_tmp_allTimestamps);
+	// Hand over the chunks in the order that they were requested,
+	// and forget about them straight away
+	while (!_tmp_texts_received.isEmpty()
+			&& _tmp_texts_received.firstKey() == textChunksEmitted)
+	{
+		QVector<WikiPage> chunkPages = _tmp_texts_received.take(textChunksEmitted);
+		if (!chunkPages.isEmpty())
+			emit wikiTextChunkFetched(chunkPages);
+		++textChunksEmitted;
+	}
 }
 
 void
 WikiQuerier::finalizeWikiText()
 {
+	// A failed chunk leaves a gap. Don't let it hold back the chunks that made it.
+	for (const QVector<WikiPage>& chunkPages : _tmp_texts_received)
+	{
+		if (!chunkPages.isEmpty())
+			emit wikiTextChunkFetched(chunkPages);
+	}
+	_tmp_texts_received.clear();
+
 	isBusy = false;
-	emit wikiTextFetched(_tmp_texts);
+	emit wikiTextFetched();
 }
@@ -5,11 +5,14 @@
 #define WIKIQUERIER_H
 
 #include <QObject>
-#include <QJsonArray>
+#include <QJsonObject>
 #include <QVector>
 #include <QMap>
-
-class QNetworkAccessManager;
+#include <QSet>
+#include <QStringList>
+#include "syncmetrics.h"
+#include "wikipage.h"
+#include "wikitransport.h"
 
 class WikiQuerier : public QObject
 {
@@ -18,48 +21,103 @@ public:
 	explicit WikiQuerier(QObject* parent = nullptr);
 
 	void setNetworkAccessManager(QNetworkAccessManager* nam)
-	{ this->nam = nam; }
+	{ transport->setNetworkAccessManager(nam); }
+
+	void setApiUrl(const QUrl& url);
+
+	// Namespaces to list and watch for changes, if the wiki has them.
+	// Empty = Every namespace except the talk namespaces.
+	void setIncludedNamespaces(const QVector<int>& namespaceIds);
+
+	WikiTransport* networkTransport() const
+	{ return transport; }
+
+	void setMetrics(SyncMetrics* metrics)
+	{ _metrics = metrics; transport->setMetrics(metrics); }
+
+	// Number of chunk requests that may be in flight at the same time
+	void setMaxConcurrentRequests(int count);
+	int maxConcurrentRequests() const { return _maxConcurrentRequests; }
 
-	void queryPageList();
-	void queryLastModified(const QVector<int>& pageIds);
+	// Finds out which of the wiki's namespaces are mirrored (see setIncludedNamespaces()).
+	// Only asks the wiki once.
+	void queryNamespaces();
+	QVector<int> namespaces() const { return _namespaces; }
+
+	void queryLatestChange();
+	void queryRecentChanges(const QString& since);
+	void queryPageList(const QString& resumePoint = QString());
 	void downloadPages(const QVector<int>& pageIds);
 	bool lastOperationWasCompleted() const { return _lastOpWasCompleted; }
 
 signals:
+	void namespacesFetched(bool ok) const;
+	// The parts of the wiki's siteinfo that WikiLinks needs (see WikiLinks::fromSiteInfo())
+	void siteInfoFetched(const QJsonObject& siteInfo) const;
+	void latestChangeFetched(const QString& timestamp) const;
+	void recentChangesFetched(const QVector<int>& changedIds, const QStringList& deletedTitles, const QString& latestTimestamp) const;
+	// resumePoint is empty after the last chunk
+	void pageInfoChunkFetched(const QMap<int, QString>& timestampMap, const QString& resumePoint) const;
 	void pageListFetched(const QVector<int>& pageIds) const;
-	void timestampsFetched(const QMap<int, QString>& timestampMap) const;
-	void wikiTextFetched(const QJsonArray& data) const;
+	void wikiTextChunkFetched(const QVector<WikiPage>& pages) const;
+	void wikiTextFetched() const;
 
 private:
-	void fetchPageListChunk(int namespaceId = 0, const QString& apcontinue = QString());
-	void fetchTimestampChunk(QVector<int> ids);
-	void fetchTextChunk(QVector<int> pageIds);
-
+	void fetchRecentChangesChunk(const QMap<QString, QString>& continuation = QMap<QString, QString>());
+	void fetchIdsOfTitles(int chunkIdx);
+	void withNamespaces(const std::function<void(bool ok)>& next);
+	void fetchPageListChunk(int namespaceId, const QMap<QString, QString>& continuation = QMap<QString, QString>());
+	QString listingResumePoint() const;
+	void fetchTextChunk(int chunkIdx, const QVector<int>& pageIds);
+	void dispatchTextChunks();
+	void adaptTextChunkSize(int pageCount, qint64 elapsedMs, int replySize);
+
+	void finalizeRecentChanges();
 	void finalizePageLists();
-	void finalizeTimestamps();
+	void flushTextChunks();
 	void finalizeWikiText();
 
-	QNetworkAccessManager* nam;
+	WikiTransport* transport;
+	SyncMetrics* _metrics;
 	bool isBusy;
 	bool _lastOpWasCompleted;
-	int namespaceListIdx;
 
-	// List of all IDs
-	QVector<int> _tmp_allIds;
+	// Namespaces to mirror. Discovered from the wiki, then filtered (see withNamespaces()).
+	QVector<int> _includedNamespaces;
+	QVector<int> _namespaces;
+	bool namespacesKnown;
 
-	// Temporaries for querying metadata
-	QVector<QVector<int>> _tmp_allIds_chunked; // TODO: Calculate each iteration?
-	int idChunkIdx;
+	// Request window
+	int _maxConcurrentRequests;
+	int requestsInFlight;
+	bool chunkFailed;
 
-	// Temporaries for storing timestamps
-	QMap<int, QString> _tmp_allTimestamps;
+	// Temporaries for walking the recent changes
+	QString _tmp_rcSince;
+	QString _tmp_rcLatest;
+	QSet<int> _tmp_rcChangedIds;
+	QSet<QString> _tmp_rcDeletedTitles;
+	QVector<QStringList> _tmp_rcTitles_chunked; // Pages that were only identified by title
 
-	// Temporaries for querying page texts
-	QVector<QVector<int>> _tmp_texts_chunked;
-	int textChunkIdx;
+	// Temporaries for listing pages. Each namespace is walked on its own.
+	QVector<int> _tmp_allIds;
+	QVector<int> _tmp_nsQueue; // Not started yet
+	QMap<int, QMap<QString, QString>> _tmp_nsContinuations; // Being listed -> Continuation of the pending chunk
+	QSet<int> _tmp_nsDone;
+	bool listingFailed;
 
-	// Temporaries for storing page texts
-	QJsonArray _tmp_texts;
+	// Temporaries for querying page texts
+	QVector<int> _tmp_texts_queue;
+	int textQueuePos;  // Next page to request
+	int textChunkSize; // Pages per request, adapted to how the server copes
+	int textChunkIdx;  // Next chunk to send
+	int textChunksEmitted;
+	int consecutiveChunkFailures;
+	QVector<int> _tmp_texts_failed;
+
+	// Chunks that arrived before their predecessors.
+	// They are held here until they can be emitted in order.
+	QMap<int, QVector<WikiPage>> _tmp_texts_received;
 };
 
 #endif // WIKIQUERIER_H
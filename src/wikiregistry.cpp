@@ -0,0 +1,250 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "wikiregistry.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QSet>
+
+#include <QDebug>
+
+// Enough to keep a few wikis busy at once (WikiQuerier sends at most 6 requests per wiki)
+static const int defaultMaxTotalRequests = 12;
+
+// The wiki that is mirrored when there is no list. Keeps the database that it has always had.
+static const QString defaultWikiName = "qt";
+static const QString defaultDatabaseFile = "data.db";
+
+// Names end up in file names and connection names
+static const QRegularExpression validName("^[A-Za-z0-9_-]+$");
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+WikiRegistry::WikiRegistry(QObject* parent) :
+	QObject(parent),
+	budget(defaultMaxTotalRequests),
+	jobsRunning(0),
+	jobsSucceeded(true)
+{
+}
+
+WikiRegistry::~WikiRegistry()
+{
+	// The transports' queued requests refer to the budget
+	qDeleteAll(coordinators);
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+bool
+WikiRegistry::load(const QString& filePath)
+{
+	clear();
+	if (!QFile::exists(filePath))
+	{
+		addDefaultWiki();
+		return true;
+	}
+
+	if (!readList(filePath))
+	{
+		clear();
+		addDefaultWiki();
+		return false;
+	}
+	return true;
+}
+
+void
+WikiRegistry::setNetworkAccessManager(QNetworkAccessManager* nam)
+{
+	for (DataCoordinator* dc : coordinators)
+		dc->setNetworkAccessManager(nam);
+}
+
+void
+WikiRegistry::setMaxConcurrentRequests(int perWiki)
+{
+	for (DataCoordinator* dc : coordinators)
+		dc->setMaxConcurrentRequests(perWiki);
+}
+
+void
+WikiRegistry::refresh(const QStringList& names, bool fullCrawl)
+{
+	runJob(names, [=](DataCoordinator* dc)
+	{
+		dc->refreshDatabase(fullCrawl);
+	});
+}
+
+void
+WikiRegistry::rescan(const QStringList& names)
+{
+	runJob(names, [](DataCoordinator* dc)
+	{
+		dc->forceRederiveData();
+	});
+}
+
+void
+WikiRegistry::exportData(const QStringList& names, const QString& exportDir)
+{
+	bool separate = names.count() > 1;
+	runJob(names, [=](DataCoordinator* dc)
+	{
+		if (!separate)
+		{
+			dc->exportData(exportDir);
+			return;
+		}
+
+		QDir dir(exportDir);
+		dir.mkpath(dc->wikiName());
+		dc->exportData(dir.filePath(dc->wikiName()));
+	});
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+bool
+WikiRegistry::readList(const QString& filePath)
+{
+	QFile file(filePath);
+	if (!file.open(QFile::ReadOnly))
+	{
+		qWarning() << "ERROR: WikiRegistry: Cannot open" << filePath << ":" << file.errorString();
+		return false;
+	}
+	QJsonParseError parseError;
+	QJsonObject outerObj = QJsonDocument::fromJson(file.readAll(), &parseError).object();
+	if (parseError.error != QJsonParseError::NoError)
+	{
+		qWarning() << "ERROR: WikiRegistry: Cannot parse" << filePath << ":" << parseError.errorString();
+		return false;
+	}
+
+	if (outerObj.contains("maxTotalRequests"))
+		budget.setMaxInFlight(outerObj["maxTotalRequests"].toInt(defaultMaxTotalRequests));
+
+	// Two wikis in one database would overwrite each other's pages and sync state.
+	// NOTE: In lower case, for case-insensitive file systems
+	QSet<QString> databasePaths;
+	for (const QJsonValue& value : outerObj["wikis"].toArray())
+	{
+		QJsonObject wikiObj = value.toObject();
+		WikiSite site;
+		site.name = wikiObj["name"].toString();
+		site.apiUrl = QUrl(wikiObj["api"].toString());
+		site.databaseFile = wikiObj["database"].toString(site.name + ".db");
+		for (const QJsonValue& namespaceValue : wikiObj["namespaces"].toArray())
+			site.namespaces << namespaceValue.toInt();
+
+		if (!validName.match(site.name).hasMatch() || coordinators.contains(site.name))
+		{
+			qWarning() << "ERROR: WikiRegistry: Invalid or duplicate wiki name" << site.name << "in" << filePath;
+			return false;
+		}
+		if (!site.apiUrl.isValid() || site.apiUrl.scheme().isEmpty())
+		{
+			qWarning() << "ERROR: WikiRegistry: Invalid API URL for" << site.name << "in" << filePath;
+			return false;
+		}
+		QString databasePath = QDir::cleanPath(QFileInfo(site.databaseFile).absoluteFilePath()).toLower();
+		if (databasePaths.contains(databasePath))
+		{
+			qWarning() << "ERROR: WikiRegistry: Database file" << site.databaseFile << "of" << site.name
+					<< "is already used by another wiki in" << filePath;
+			return false;
+		}
+		databasePaths.insert(databasePath);
+		addWiki(site);
+	}
+
+	if (_names.isEmpty())
+	{
+		qWarning() << "ERROR: WikiRegistry: No wikis listed in" << filePath;
+		return false;
+	}
+	return true;
+}
+
+void
+WikiRegistry::clear()
+{
+	qDeleteAll(coordinators);
+	coordinators.clear();
+	_names.clear();
+}
+
+void
+WikiRegistry::addDefaultWiki()
+{
+	addWiki(WikiSite{defaultWikiName, QUrl(), defaultDatabaseFile});
+}
+
+void
+WikiRegistry::addWiki(const WikiSite& site)
+{
+	auto dc = new DataCoordinator(site, this);
+	dc->setRequestBudget(&budget);
+
+	connect(dc, &DataCoordinator::currentJobFinished, [=](bool success)
+	{
+		// Jobs that were started on the coordinator directly are none of our business
+		if (jobsRunning == 0)
+			return;
+
+		if (!success)
+		{
+			jobsSucceeded = false;
+			qDebug() << "ERROR: WikiRegistry: Job failed for wiki" << site.name;
+		}
+		if (--jobsRunning == 0)
+			emit jobsFinished(jobsSucceeded);
+	});
+
+	_names << site.name;
+	coordinators[site.name] = dc;
+}
+
+void
+WikiRegistry::runJob(const QStringList& names, const std::function<void(DataCoordinator*)>& job)
+{
+	if (jobsRunning > 0)
+	{
+		qDebug() << "ERROR: WikiRegistry: Jobs are still running.";
+		return;
+	}
+
+	QVector<DataCoordinator*> selected;
+	for (const QString& name : names)
+	{
+		if (!coordinators.contains(name))
+		{
+			qDebug() << "ERROR: WikiRegistry: Unknown wiki" << name;
+			continue;
+		}
+		selected << coordinators[name];
+	}
+	if (selected.isEmpty())
+	{
+		emit jobsFinished(false);
+		return;
+	}
+
+	// NOTE: A job may finish right away (e.g. nothing to do), so count them all in first
+	jobsSucceeded = selected.count() == names.count();
+	jobsRunning = selected.count();
+	for (DataCoordinator* dc : selected)
+		job(dc);
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef WIKIREGISTRY_H
+#define WIKIREGISTRY_H
+
+#include <QObject>
+#include <QMap>
+#include <QStringList>
+#include "datacoordinator.h"
+#include "wikisite.h"
+#include "wikitransport.h"
+#include <functional>
+
+class QNetworkAccessManager;
+
+// The wikis that are mirrored, each with its own DataCoordinator (and so its
+// own querier and database file).
+//
+// The list is read from a JSON file:
+//   {
+//     "maxTotalRequests": 12,
+//     "wikis": [
+//       {"name": "qt", "api": "https://wiki.qt.io/api.php", "database": "data.db"},
+//       {"name": "kde", "api": "https://community.kde.org/api.php", "namespaces": [0, 4, 10]}
+//     ]
+//   }
+// "database" defaults to "<name>.db". "namespaces" defaults to all but the
+// talk namespaces. Without the file, only the Qt Wiki is
+// mirrored, into data.db.
+//
+// Jobs for several wikis run at the same time. All requests count against
+// one budget, so that mirroring more wikis doesn't mean more load on the
+// network than asked for.
+class WikiRegistry : public QObject
+{
+	Q_OBJECT
+
+signals:
+	// After every wiki of the last refresh()/rescan()/exportData() has finished
+	void jobsFinished(bool allSucceeded) const;
+
+public:
+	explicit WikiRegistry(QObject* parent = nullptr);
+	~WikiRegistry();
+
+	// Returns false if the file exists but can't be used. Only the Qt Wiki is left then.
+	bool load(const QString& filePath);
+
+	QStringList names() const { return _names; }
+	DataCoordinator* coordinator(const QString& name) const
+	{ return coordinators.value(name); }
+
+	void setNetworkAccessManager(QNetworkAccessManager* nam);
+	void setMaxConcurrentRequests(int perWiki);
+	void setMaxTotalRequests(int count)
+	{ budget.setMaxInFlight(count); }
+	int maxTotalRequests() const
+	{ return budget.maxInFlight(); }
+
+	bool isBusy() const { return jobsRunning > 0; }
+
+	void refresh(const QStringList& names, bool fullCrawl = false);
+	void rescan(const QStringList& names);
+
+	// With more than one wiki, each one is exported into a subfolder named after it
+	void exportData(const QStringList& names, const QString& exportDir);
+
+private:
+	bool readList(const QString& filePath);
+	void clear();
+	void addDefaultWiki();
+	void addWiki(const WikiSite& site);
+	void runJob(const QStringList& names, const std::function<void(DataCoordinator*)>& job);
+
+	RequestBudget budget;
+	QStringList _names;
+	QMap<QString, DataCoordinator*> coordinators;
+
+	int jobsRunning;
+	bool jobsSucceeded;
+};
+
+#endif // WIKIREGISTRY_H
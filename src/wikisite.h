@@ -0,0 +1,20 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef WIKISITE_H
+#define WIKISITE_H
+
+#include <QString>
+#include <QUrl>
+#include <QVector>
+
+// One mirrored wiki (see WikiRegistry)
+struct WikiSite
+{
+	QString name;         // Also names the database connection. Empty = Qt's default connection.
+	QUrl apiUrl;          // Empty = WikiTransport's default
+	QString databaseFile; // Relative to the data folder. Empty = data.db
+	QVector<int> namespaces; // IDs of the namespaces to mirror. Empty = All but the talk namespaces.
+};
+
+#endif // WIKISITE_H
@@ -0,0 +1,375 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "wikitransport.h"
+#include "syncmetrics.h"
+
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QRandomGenerator>
+#include <QScopedPointer>
+#include <QSharedPointer>
+#include <QTimer>
+
+#include <zlib.h>
+
+#include <QDebug>
+
+static const QString defaultApiUrl = "https://wiki.qt.io/api.php";
+
+// See https://www.mediawiki.org/wiki/Manual:Maxlag_parameter
+static const int maxLagSeconds = 5;
+
+// Retries, for transient failures and when the server asks us to back off
+static const int maxAttempts = 6;
+static const int baseRetryDelayMs = 1000;
+static const int maxRetryDelayMs = 120000;
+
+// A reply that sends nothing for this long is given up on (and retried)
+static const int stallTimeoutMs = 60000;
+
+// Decodes a gzip (or zlib) stream one piece at a time
+class StreamInflater
+{
+public:
+	StreamInflater() : failed(false)
+	{
+		stream.zalloc = Z_NULL;
+		stream.zfree = Z_NULL;
+		stream.opaque = Z_NULL;
+		stream.next_in = Z_NULL;
+		stream.avail_in = 0;
+
+		// 32 = Detect the gzip/zlib header automatically
+		failed = inflateInit2(&stream, 15 + 32) != Z_OK;
+	}
+	~StreamInflater()
+	{ inflateEnd(&stream); }
+
+	bool hasFailed() const { return failed; }
+
+	QByteArray inflate(const QByteArray& input)
+	{
+		QByteArray output;
+		if (failed || input.isEmpty())
+			return output;
+
+		char buffer[16384];
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.constData()));
+		stream.avail_in = static_cast<uInt>(input.size());
+		int ret;
+		do
+		{
+			stream.next_out = reinterpret_cast<Bytef*>(buffer);
+			stream.avail_out = sizeof(buffer);
+			ret = ::inflate(&stream, Z_NO_FLUSH);
+			if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+			{
+				failed = true;
+				break;
+			}
+			output.append(buffer, static_cast<int>(sizeof(buffer) - stream.avail_out));
+		} while (stream.avail_out == 0 && ret != Z_STREAM_END);
+
+		return output;
+	}
+
+private:
+	z_stream stream;
+	bool failed;
+};
+
+// Collects the whole body for a ReplyHandler
+class BufferedReplyStream : public ReplyStream
+{
+public:
+	explicit BufferedReplyStream(const WikiTransport::ReplyHandler& handler) :
+		handler(handler)
+	{}
+
+	void restart() override
+	{ body.clear(); }
+
+	void append(const QByteArray& piece) override
+	{ body.append(piece); }
+
+	void finish(bool ok, qint64) override
+	{ handler(ok ? body : QByteArray()); }
+
+private:
+	WikiTransport::ReplyHandler handler;
+	QByteArray body;
+};
+
+/**********************************************************************\
+ * CONSTRUCTOR/DESTRUCTOR
+\**********************************************************************/
+RequestBudget::RequestBudget(int maxInFlight) :
+	_maxInFlight(qMax(1, maxInFlight)),
+	_inFlight(0)
+{}
+
+WikiTransport::WikiTransport(QObject* parent) :
+	QObject(parent),
+	nam(nullptr),
+	_apiUrl(defaultApiUrl),
+	_metrics(nullptr),
+	_budget(nullptr)
+{
+	resetStats();
+}
+
+/**********************************************************************\
+ * PUBLIC
+\**********************************************************************/
+void
+RequestBudget::setMaxInFlight(int count)
+{
+	_maxInFlight = qMax(1, count);
+	startWaiting();
+}
+
+void
+RequestBudget::acquire(const std::function<void()>& start)
+{
+	waiting.enqueue(start);
+	startWaiting();
+}
+
+void
+RequestBudget::release()
+{
+	if (_inFlight > 0)
+		--_inFlight;
+	startWaiting();
+}
+
+void
+WikiTransport::setApiUrl(const QUrl& url)
+{
+	if (!url.isValid() || url.scheme().isEmpty())
+	{
+		qDebug() << "ERROR: WikiTransport: Invalid API URL:" << url;
+		return;
+	}
+	_apiUrl = url;
+}
+
+void
+WikiTransport::get(const QUrlQuery& query, const ReplyHandler& handler)
+{
+	get(query, QSharedPointer<ReplyStream>(new BufferedReplyStream(handler)));
+}
+
+void
+WikiTransport::get(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream)
+{
+	// Asks the server to turn us away while its replicas are lagging, instead of adding to the load
+	QUrlQuery politeQuery(query);
+	politeQuery.addQueryItem("maxlag", QString::number(maxLagSeconds));
+
+	sendRequest(politeQuery, stream, 0);
+}
+
+void
+WikiTransport::resetStats()
+{
+	_requestCount = 0;
+	_http2RequestCount = 0;
+	_retryCount = 0;
+	_wireBytes = 0;
+	_decodedBytes = 0;
+}
+
+/**********************************************************************\
+ * PRIVATE
+\**********************************************************************/
+void
+RequestBudget::startWaiting()
+{
+	while (_inFlight < _maxInFlight && !waiting.isEmpty())
+	{
+		++_inFlight;
+		waiting.dequeue()();
+	}
+}
+
+void
+WikiTransport::sendRequest(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream, int attempt)
+{
+	if (!_budget)
+	{
+		startRequest(query, stream, attempt);
+		return;
+	}
+
+	// NOTE: The transport outlives its queued requests (see WikiRegistry)
+	_budget->acquire([=]
+	{
+		startRequest(query, stream, attempt);
+	});
+}
+
+void
+WikiTransport::startRequest(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream, int attempt)
+{
+	QUrl url(_apiUrl);
+	url.setQuery(query);
+
+	QNetworkRequest netRequest(url);
+	netRequest.setRawHeader("User-Agent", "Wique 0.5");
+
+	// NOTE: QNAM stops decoding replies by itself once Accept-Encoding is set by hand.
+	// That's intended: it's the only way to see how many bytes actually came over the wire.
+	netRequest.setRawHeader("Accept-Encoding", "gzip");
+
+	// Multiplexes all requests over one connection (negotiated over TLS only)
+	netRequest.setAttribute(QNetworkRequest::HTTP2AllowedAttribute, true);
+
+	++_requestCount;
+	stream->restart();
+	QElapsedTimer latencyTimer;
+	latencyTimer.start();
+	QNetworkReply* reply = nam->get(netRequest);
+
+	// Give up on replies that stop sending data. The abort() ends up as OperationCanceledError.
+	auto watchdog = new QTimer(reply);
+	watchdog->setSingleShot(true);
+	connect(watchdog, &QTimer::timeout, reply, &QNetworkReply::abort);
+	watchdog->start(stallTimeoutMs);
+
+	// Decode the body and pass it on as it arrives, instead of all at once at the end
+	auto inflater = QSharedPointer<QScopedPointer<StreamInflater>>::create();
+	auto consume = [=]
+	{
+		watchdog->start(stallTimeoutMs);
+
+		QByteArray raw = reply->readAll();
+		_wireBytes += raw.size();
+
+		// Error pages are not for the stream
+		int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+		if (raw.isEmpty() || httpStatus < 200 || httpStatus >= 300)
+			return;
+
+		if (inflater->isNull() && reply->rawHeader("Content-Encoding").toLower().contains("gzip"))
+			inflater->reset(new StreamInflater);
+
+		QByteArray piece = *inflater ? (*inflater)->inflate(raw) : raw;
+		_decodedBytes += piece.size();
+		if (!piece.isEmpty())
+			stream->append(piece);
+	};
+
+	connect(reply, &QNetworkReply::readyRead, this, consume);
+	connect(reply, &QNetworkReply::finished, this, [=]
+	{
+		consume();
+		watchdog->stop();
+		reply->deleteLater();
+		if (_budget)
+			_budget->release();
+
+		qint64 latencyMs = latencyTimer.elapsed();
+		if (_metrics)
+			_metrics->observe("request_latency_ms", latencyMs);
+
+		if (reply->attribute(QNetworkRequest::HTTP2WasUsedAttribute).toBool())
+			++_http2RequestCount;
+
+		int delayMs = retryDelayOf(reply, attempt);
+		if (delayMs >= 0)
+		{
+			if (attempt + 1 < maxAttempts)
+			{
+				qDebug() << "\tRequest not served" << qPrintable(describeFailure(reply))
+						<< "- retrying in" << delayMs << "ms";
+				++_retryCount;
+				QTimer::singleShot(delayMs, this, [=]
+				{
+					sendRequest(query, stream, attempt + 1);
+				});
+				return;
+			}
+			qDebug() << "ERROR: WikiTransport: Giving up after" << maxAttempts << "attempts:" << qPrintable(describeFailure(reply));
+			stream->finish(false, latencyMs);
+			return;
+		}
+
+		if (reply->error() != QNetworkReply::NoError)
+		{
+			qDebug() << "ERROR: WikiTransport: Request failed:" << reply->errorString();
+			stream->finish(false, latencyMs);
+			return;
+		}
+		if (*inflater && (*inflater)->hasFailed())
+		{
+			qDebug() << "ERROR: WikiTransport: Corrupt gzip stream from" << reply->url();
+			stream->finish(false, latencyMs);
+			return;
+		}
+
+		stream->finish(true, latencyMs);
+	});
+}
+
+int
+WikiTransport::retryDelayOf(QNetworkReply* reply, int attempt)
+{
+	int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	QByteArray apiError = reply->rawHeader("MediaWiki-API-Error");
+
+	bool retryable = false;
+	switch (reply->error())
+	{
+	case QNetworkReply::NoError:
+		// maxlag/ratelimited errors can come with HTTP 200
+		retryable = apiError == "maxlag" || apiError == "ratelimited";
+		break;
+
+	// Transient failures
+	case QNetworkReply::RemoteHostClosedError:
+	case QNetworkReply::TimeoutError:
+	case QNetworkReply::OperationCanceledError: // Stalled (see watchdog)
+	case QNetworkReply::TemporaryNetworkFailureError:
+	case QNetworkReply::NetworkSessionFailedError:
+	case QNetworkReply::ProxyTimeoutError:
+	case QNetworkReply::UnknownNetworkError:
+	case QNetworkReply::InternalServerError:
+	case QNetworkReply::ServiceUnavailableError:
+	case QNetworkReply::UnknownServerError:
+		retryable = true;
+		break;
+
+	default:
+		// 429 Too Many Requests, 502 Bad Gateway, 504 Gateway Timeout
+		retryable = httpStatus == 429 || httpStatus == 502 || httpStatus == 504;
+		break;
+	}
+	if (!retryable)
+		return -1;
+
+	// The server knows best. Only the delta-seconds form of Retry-After is used by MediaWiki.
+	bool ok;
+	int retryAfter = reply->rawHeader("Retry-After").trimmed().toInt(&ok);
+	if (ok && retryAfter >= 0)
+		return qMin(retryAfter * 1000, maxRetryDelayMs);
+
+	// Exponential backoff, with some jitter so that parallel requests don't come back in lockstep
+	int delayMs = qMin(baseRetryDelayMs << qMin(attempt, 16), maxRetryDelayMs);
+	return delayMs + static_cast<int>(QRandomGenerator::global()->bounded(delayMs / 4 + 1));
+}
+
+QString
+WikiTransport::describeFailure(QNetworkReply* reply)
+{
+	QByteArray apiError = reply->rawHeader("MediaWiki-API-Error");
+	if (!apiError.isEmpty())
+		return QString("(%1, lag %2 s)").arg(QString::fromUtf8(apiError), QString::fromUtf8(reply->rawHeader("X-Database-Lag")));
+
+	int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+	if (httpStatus != 0)
+		return QString("(HTTP %1)").arg(httpStatus);
+	return QString("(%1)").arg(reply->errorString());
+}
@@ -0,0 +1,127 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#ifndef WIKITRANSPORT_H
+#define WIKITRANSPORT_H
+
+#include <QObject>
+#include <QUrl>
+#include <QUrlQuery>
+#include <QByteArray>
+#include <QQueue>
+#include <QSharedPointer>
+#include <functional>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class SyncMetrics;
+
+// Receives a reply body piece by piece, as it is decoded
+class ReplyStream
+{
+public:
+	virtual ~ReplyStream() {}
+
+	// Called before every attempt. Whatever came in before is void.
+	virtual void restart() {}
+
+	virtual void append(const QByteArray& piece) = 0;
+
+	// The request is over for good. latencyMs is how long the last attempt took,
+	// without the time spent queued or backing off before it.
+	virtual void finish(bool ok, qint64 latencyMs) = 0;
+};
+
+// Caps the number of requests in flight across several WikiTransports
+// (e.g. one per wiki). Requests over the cap wait their turn, first come
+// first served.
+//
+// NOTE: Not thread-safe. The transports must all live in the same thread.
+class RequestBudget
+{
+public:
+	explicit RequestBudget(int maxInFlight);
+
+	void setMaxInFlight(int count);
+	int maxInFlight() const { return _maxInFlight; }
+	int inFlight() const { return _inFlight; }
+
+	// Calls start() as soon as a slot is free, which may be right away.
+	// The slot must be handed back with release().
+	void acquire(const std::function<void()>& start);
+	void release();
+
+private:
+	void startWaiting();
+
+	int _maxInFlight;
+	int _inFlight;
+	QQueue<std::function<void()>> waiting;
+};
+
+// Sends GET requests to a MediaWiki API endpoint.
+//
+// Replies are requested gzip-compressed and decoded here as they stream in,
+// so that the number of bytes on the wire can be compared against the number
+// of bytes that were handed over. HTTP/2 is used where the server supports it
+// (HTTPS only), which lets all requests share a single connection.
+//
+// Transient failures are retried with exponential backoff. Every request
+// carries maxlag, and the server's Retry-After is honoured when it asks us
+// to slow down.
+class WikiTransport : public QObject
+{
+	Q_OBJECT
+
+public:
+	// Receives the decoded body, or an empty array if the request failed for good
+	typedef std::function<void(const QByteArray& body)> ReplyHandler;
+
+	explicit WikiTransport(QObject* parent = nullptr);
+
+	void setNetworkAccessManager(QNetworkAccessManager* nam)
+	{ this->nam = nam; }
+
+	void setApiUrl(const QUrl& url);
+	QUrl apiUrl() const { return _apiUrl; }
+
+	// Receives the latency of every attempt (optional)
+	void setMetrics(SyncMetrics* metrics)
+	{ _metrics = metrics; }
+
+	// Shared with other transports (optional). Every attempt takes a slot.
+	void setRequestBudget(RequestBudget* budget)
+	{ _budget = budget; }
+
+	void get(const QUrlQuery& query, const ReplyHandler& handler);
+	void get(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream);
+
+	// Traffic since the last reset
+	void resetStats();
+	int requestCount() const { return _requestCount; }
+	int http2RequestCount() const { return _http2RequestCount; }
+	int retryCount() const { return _retryCount; }
+	qint64 wireBytes() const { return _wireBytes; }
+	qint64 decodedBytes() const { return _decodedBytes; }
+
+private:
+	void sendRequest(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream, int attempt);
+	void startRequest(const QUrlQuery& query, const QSharedPointer<ReplyStream>& stream, int attempt);
+
+	// Returns how long to wait before trying again, or -1 if the failure is permanent (or there was none)
+	static int retryDelayOf(QNetworkReply* reply, int attempt);
+	static QString describeFailure(QNetworkReply* reply);
+
+	QNetworkAccessManager* nam;
+	QUrl _apiUrl;
+	SyncMetrics* _metrics;
+	RequestBudget* _budget;
+
+	int _requestCount;
+	int _http2RequestCount;
+	int _retryCount;
+	qint64 _wireBytes;
+	qint64 _decodedBytes;
+};
+
+#endif // WIKITRANSPORT_H
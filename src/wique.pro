@@ -1,20 +1,45 @@
 # -------------------------------------------------
 # Project created by QtCreator 2010-11-21T17:03:48
 # -------------------------------------------------
-QT += network widgets sql
+QT += network widgets sql concurrent
 CONFIG += C++11
 TARGET = Wique
 TEMPLATE = app
+
+# zlib decodes the gzip'ed replies. Qt ships its own copy on Windows.
+unix: LIBS += -lz
+win32: INCLUDEPATH += $$[QT_INSTALL_HEADERS]/QtZlib
 SOURCES += main.cpp \
 	database.cpp \
     datacoordinator.cpp \
+    headless.cpp \
+    jsonstreamreader.cpp \
+    logsink.cpp \
+    pagetablemodel.cpp \
+    redirectgraph.cpp \
+    syncmetrics.cpp \
+    wikilinks.cpp \
     wikiquerier.cpp \
+    wikiregistry.cpp \
+    wikitransport.cpp \
     gui/databaseui.cpp \
     gui/spreadsheetview.cpp
 HEADERS += \
 	database.h \
     datacoordinator.h \
+    headless.h \
+    jsonstreamreader.h \
+    logsink.h \
+    pagetablemodel.h \
+    queryresults.h \
+    redirectgraph.h \
+    syncmetrics.h \
+    wikilinks.h \
+    wikipage.h \
     wikiquerier.h \
+    wikiregistry.h \
+    wikisite.h \
+    wikitransport.h \
     gui/databaseui.h \
     gui/spreadsheetview.h
 
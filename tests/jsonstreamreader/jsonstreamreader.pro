@@ -0,0 +1,17 @@
+# -------------------------------------------------
+# Unit tests of JsonStreamReader
+# -------------------------------------------------
+QT += testlib
+QT -= gui
+CONFIG += C++11 console testcase
+CONFIG -= app_bundle
+TARGET = tst_jsonstreamreader
+TEMPLATE = app
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += tst_jsonstreamreader.cpp \
+    $$WIQUE_SRC/jsonstreamreader.cpp
+HEADERS += \
+    $$WIQUE_SRC/jsonstreamreader.h
@@ -0,0 +1,200 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "jsonstreamreader.h"
+
+#include <QtTest>
+
+// Writes down every event as "path=value", e.g. "query.pages[0].title=Foo"
+class EventRecorder : public JsonStreamReader::Handler
+{
+public:
+	void beginContainer(const JsonStreamReader& reader) override
+	{ events << path(reader, reader.depth() - 1) + (reader.isObjectAt(reader.depth() - 1) ? "{" : "["); }
+
+	void endContainer(const JsonStreamReader& reader) override
+	{ events << path(reader, reader.depth() - 1) + (reader.isObjectAt(reader.depth() - 1) ? "}" : "]"); }
+
+	void scalar(const JsonStreamReader& reader, const QJsonValue& value) override
+	{
+		QString text = value.isString() ? value.toString() : value.toVariant().toString();
+		if (value.isNull())
+			text = "null";
+		events << path(reader, reader.depth()) + '=' + text;
+	}
+
+	QStringList events;
+
+private:
+	static QString path(const JsonStreamReader& reader, int levels)
+	{
+		QString result;
+		for (int level = 0; level < levels; ++level)
+		{
+			if (reader.isObjectAt(level))
+				result += (result.isEmpty() ? "" : ".") + reader.keyAt(level);
+			else
+				result += QString("[%1]").arg(reader.indexAt(level));
+		}
+		return result;
+	}
+};
+
+// The single string in a one-element array
+static QString
+parseString(const QByteArray& json)
+{
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	if (!reader.feed(json) || !reader.isFinished() || recorder.events.count() != 3)
+		return "<error>";
+	return recorder.events[1].mid(QString("[0]=").size());
+}
+
+class TestJsonStreamReader : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void document();
+	void byteByByte();
+	void surrogates_data();
+	void surrogates();
+	void surrogatesAcrossStrings();
+	void malformed_data();
+	void malformed();
+	void reset();
+};
+
+void
+TestJsonStreamReader::document()
+{
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	QVERIFY(reader.feed(R"({"query": {"pages": [{"id": 12, "title": "Foo \"Bar\"", "new": true}, null]}, "n": -1.5e2})"));
+	QVERIFY(reader.isFinished());
+	QCOMPARE(recorder.events, (QStringList{
+			"{",
+			"query{",
+			"query.pages[",
+			"query.pages[0]{",
+			"query.pages[0].id=12",
+			"query.pages[0].title=Foo \"Bar\"",
+			"query.pages[0].new=true",
+			"query.pages[0]}",
+			"query.pages[1]=null",
+			"query.pages]",
+			"query}",
+			"n=-150",
+			"}"}));
+}
+
+void
+TestJsonStreamReader::byteByByte()
+{
+	// Every token, escape and UTF-8 sequence gets split somewhere
+	QByteArray json = R"({"a": [1, 23, "x\tyé😀"], "b": false, "c": "é"})";
+
+	EventRecorder whole;
+	JsonStreamReader(&whole).feed(json);
+
+	EventRecorder pieces;
+	JsonStreamReader reader(&pieces);
+	for (char c : json)
+		QVERIFY(reader.feed(QByteArray(1, c)));
+	QVERIFY(reader.isFinished());
+	QCOMPARE(pieces.events, whole.events);
+	QVERIFY(pieces.events.contains(QString::fromUtf8("a[2]=x\ty\xC3\xA9\xF0\x9F\x98\x80")));
+}
+
+void
+TestJsonStreamReader::surrogates_data()
+{
+	QTest::addColumn<QByteArray>("json");
+	QTest::addColumn<QString>("string");
+
+	const QString replacement(QChar(0xFFFD));
+	const QString emoji = QString::fromUtf8("\xF0\x9F\x98\x80"); // U+1F600 = 😀
+
+	QTest::newRow("pair") << QByteArray(R"(["\ud83d\ude00"])") << emoji;
+	QTest::newRow("high, then end") << QByteArray(R"(["\ud83d"])") << replacement;
+	QTest::newRow("high, then plain") << QByteArray(R"(["\ud83dx"])") << replacement + "x";
+	QTest::newRow("high, then escape") << QByteArray(R"(["\ud83d\n\ude00"])") << replacement + "\n" + replacement;
+	QTest::newRow("high, then quote escape") << QByteArray(R"(["\ud83d\""])") << replacement + "\"";
+	QTest::newRow("high, then BMP") << QByteArray(R"(["\ud83d\u0041"])") << replacement + "A";
+	QTest::newRow("two highs") << QByteArray(R"(["\ud83d\ud83d\ude00"])") << replacement + emoji;
+	QTest::newRow("lone low") << QByteArray(R"(["\ude00x"])") << replacement + "x";
+}
+
+void
+TestJsonStreamReader::surrogates()
+{
+	QFETCH(QByteArray, json);
+	QFETCH(QString, string);
+
+	QCOMPARE(parseString(json), string);
+
+	// The same, one byte at a time
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	for (char c : json)
+		QVERIFY(reader.feed(QByteArray(1, c)));
+	QCOMPARE(recorder.events.value(1), "[0]=" + string);
+}
+
+void
+TestJsonStreamReader::surrogatesAcrossStrings()
+{
+	// A surrogate at the end of one string isn't paired with the start of the next
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	QVERIFY(reader.feed(R"(["\ud83d", "\ude00"])"));
+	QString replacement(QChar(0xFFFD));
+	QCOMPARE(recorder.events, (QStringList{"[", "[0]=" + replacement, "[1]=" + replacement, "]"}));
+}
+
+void
+TestJsonStreamReader::malformed_data()
+{
+	QTest::addColumn<QByteArray>("json");
+
+	QTest::newRow("missing colon") << QByteArray(R"({"a" 1})");
+	QTest::newRow("unquoted key") << QByteArray("{a: 1}");
+	QTest::newRow("wrong bracket") << QByteArray("[1}");
+	QTest::newRow("bad escape") << QByteArray(R"(["\x"])");
+	QTest::newRow("bad hex") << QByteArray(R"(["\u12G4"])");
+	QTest::newRow("bad literal") << QByteArray("[nul]");
+	QTest::newRow("trailing garbage") << QByteArray("[] x");
+}
+
+void
+TestJsonStreamReader::malformed()
+{
+	QFETCH(QByteArray, json);
+
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	QVERIFY(!reader.feed(json));
+	QVERIFY(reader.hasError());
+
+	// Stays failed
+	QVERIFY(!reader.feed("[]"));
+}
+
+void
+TestJsonStreamReader::reset()
+{
+	EventRecorder recorder;
+	JsonStreamReader reader(&recorder);
+	QVERIFY(reader.feed(R"({"a": "\ud83d)"));
+
+	// e.g. when a request is retried
+	reader.reset();
+	recorder.events.clear();
+	QVERIFY(reader.feed(R"(["\ude00"])"));
+	QVERIFY(reader.isFinished());
+	QCOMPARE(recorder.events, (QStringList{"[", "[0]=" + QString(QChar(0xFFFD)), "]"}));
+}
+
+QTEST_APPLESS_MAIN(TestJsonStreamReader)
+#include "tst_jsonstreamreader.moc"
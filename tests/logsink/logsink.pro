@@ -0,0 +1,17 @@
+# -------------------------------------------------
+# Unit tests of LogSink
+# -------------------------------------------------
+QT += testlib
+QT -= gui
+CONFIG += C++11 console testcase
+CONFIG -= app_bundle
+TARGET = tst_logsink
+TEMPLATE = app
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += tst_logsink.cpp \
+    $$WIQUE_SRC/logsink.cpp
+HEADERS += \
+    $$WIQUE_SRC/logsink.h
@@ -0,0 +1,208 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "logsink.h"
+
+#include <QTemporaryDir>
+#include <QtTest>
+
+#include <thread>
+#include <vector>
+
+static QStringList
+messagesOf(const QVector<LogEntry>& entries)
+{
+	QStringList messages;
+	for (const LogEntry& entry : entries)
+		messages << entry.message;
+	return messages;
+}
+
+class TestLogSink : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void levels();
+	void wrapAround();
+	void dropsWhenFull();
+	void nearlyFull();
+	void postFromHandler();
+	void concurrentProducers();
+	void logFileRotation();
+};
+
+void
+TestLogSink::levels()
+{
+	LogSink sink(16);
+	sink.setMinimumLevel(LogLevel::Info);
+
+	// Discarded on purpose, so not dropped
+	QVERIFY(sink.post(QtDebugMsg, "debug"));
+	QVERIFY(sink.post(QtWarningMsg, "warning"));
+	QVERIFY(sink.post(QtInfoMsg, "info"));
+
+	auto entries = sink.drain();
+	QCOMPARE(messagesOf(entries), (QStringList{"warning", "info"}));
+	QCOMPARE(entries[0].level, LogLevel::Warning);
+	QCOMPARE(entries[1].level, LogLevel::Info);
+	QVERIFY(sink.drain().isEmpty());
+}
+
+void
+TestLogSink::wrapAround()
+{
+	// Three messages per round go several times around a ring of four
+	LogSink sink(4);
+	for (int round = 0; round < 10; ++round)
+	{
+		QStringList expected;
+		for (int i = 0; i < 3; ++i)
+		{
+			QString message = QString("%1-%2").arg(round).arg(i);
+			QVERIFY(sink.post(QtDebugMsg, message));
+			expected << message;
+		}
+		QCOMPARE(messagesOf(sink.drain()), expected);
+	}
+}
+
+void
+TestLogSink::dropsWhenFull()
+{
+	LogSink sink(4);
+	for (int i = 0; i < 4; ++i)
+		QVERIFY(sink.post(QtDebugMsg, QString::number(i)));
+	QVERIFY(!sink.post(QtDebugMsg, "4"));
+	QVERIFY(!sink.post(QtDebugMsg, "5"));
+
+	// The loss is reported first, then what fitted
+	auto entries = sink.drain();
+	QCOMPARE(messagesOf(entries), (QStringList{"ERROR: LogSink: 2 messages were dropped", "0", "1", "2", "3"}));
+	QCOMPARE(entries[0].level, LogLevel::Warning);
+
+	// Room again, and the loss isn't reported twice
+	QVERIFY(sink.post(QtDebugMsg, "6"));
+	QCOMPARE(messagesOf(sink.drain()), QStringList{"6"});
+}
+
+void
+TestLogSink::nearlyFull()
+{
+	LogSink sink(8);
+	for (int i = 0; i < 5; ++i)
+		sink.post(QtDebugMsg, QString::number(i));
+	QVERIFY(!sink.isNearlyFull());
+
+	sink.post(QtDebugMsg, "5");
+	QVERIFY(sink.isNearlyFull());
+
+	sink.drain();
+	QVERIFY(!sink.isNearlyFull());
+}
+
+void
+TestLogSink::postFromHandler()
+{
+	// The sink only drains on the spot in the application's main thread
+	int argc = 1;
+	char name[] = "tst_logsink";
+	char* argv[] = {name, nullptr};
+	QCoreApplication app(argc, argv);
+
+	LogSink sink(8);
+	QStringList flushed;
+	auto flush = [&]
+	{
+		flushed << messagesOf(sink.drain());
+	};
+
+	// A burst that is bigger than the buffer
+	QStringList expected;
+	for (int i = 0; i < 20; ++i)
+	{
+		QVERIFY(sink.postFromHandler(QtDebugMsg, QString::number(i), flush));
+		expected << QString::number(i);
+	}
+	flushed << messagesOf(sink.drain());
+	QCOMPARE(flushed, expected);
+}
+
+void
+TestLogSink::concurrentProducers()
+{
+	const int producerCount = 4;
+	const int messagesEach = 20000;
+
+	LogSink sink(256);
+	QAtomicInt finished(0);
+	std::vector<std::thread> producers;
+	for (int p = 0; p < producerCount; ++p)
+	{
+		producers.emplace_back([&sink, &finished, p, messagesEach]
+		{
+			for (int i = 0; i < messagesEach; ++i)
+				sink.post(QtDebugMsg, QString("%1:%2").arg(p).arg(i));
+			finished.fetchAndAddRelease(1);
+		});
+	}
+
+	// Every message arrives once, in the order that its thread posted it, or is counted as dropped
+	QVector<int> lastSeen(producerCount, -1);
+	int received = 0;
+	int dropped = 0;
+	auto check = [&](const QVector<LogEntry>& entries)
+	{
+		for (const LogEntry& entry : entries)
+		{
+			if (entry.message.startsWith("ERROR: LogSink: "))
+			{
+				dropped += entry.message.section(' ', 2, 2).toInt();
+				continue;
+			}
+			int producer = entry.message.section(':', 0, 0).toInt();
+			int index = entry.message.section(':', 1, 1).toInt();
+			QVERIFY(index > lastSeen[producer]);
+			lastSeen[producer] = index;
+			++received;
+		}
+	};
+	while (finished.loadAcquire() < producerCount)
+		check(sink.drain());
+	for (auto& producer : producers)
+		producer.join();
+	check(sink.drain());
+
+	QCOMPARE(received + dropped, producerCount * messagesEach);
+	QVERIFY(received > 0);
+}
+
+void
+TestLogSink::logFileRotation()
+{
+	QTemporaryDir dir;
+	QVERIFY(dir.isValid());
+	QString path = dir.filePath("wique.log");
+
+	LogSink sink;
+	QVERIFY(sink.setLogFile(path, 200, 2));
+	for (int i = 0; i < 50; ++i)
+	{
+		sink.post(QtWarningMsg, QString("Message %1").arg(i));
+		sink.drain();
+	}
+
+	QVERIFY(QFile::exists(path));
+	QVERIFY(QFile::exists(path + ".1"));
+	QVERIFY(QFile::exists(path + ".2"));
+	QVERIFY(!QFile::exists(path + ".3"));
+
+	// Each line has a timestamp and a level
+	QFile newest(path + ".1");
+	QVERIFY(newest.open(QIODevice::ReadOnly | QIODevice::Text));
+	QVERIFY(QString::fromUtf8(newest.readLine()).contains(" WARNING Message "));
+}
+
+QTEST_APPLESS_MAIN(TestLogSink)
+#include "tst_logsink.moc"
@@ -0,0 +1,17 @@
+# -------------------------------------------------
+# Unit tests of RedirectGraph
+# -------------------------------------------------
+QT += testlib
+QT -= gui
+CONFIG += C++11 console testcase
+CONFIG -= app_bundle
+TARGET = tst_redirectgraph
+TEMPLATE = app
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += tst_redirectgraph.cpp \
+    $$WIQUE_SRC/redirectgraph.cpp
+HEADERS += \
+    $$WIQUE_SRC/redirectgraph.h
@@ -0,0 +1,182 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "redirectgraph.h"
+
+#include <QtTest>
+
+typedef RedirectGraph::Resolution Resolution;
+
+class TestRedirectGraph : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void pageWithoutRedirect();
+	void chain();
+	void loop();
+	void brokenUntilTargetAppears();
+	void removedTargetBreaksChain();
+	void retargetReportsOnlyChanges();
+	void counts();
+};
+
+void
+TestRedirectGraph::pageWithoutRedirect()
+{
+	RedirectGraph graph;
+	graph.setPage(1, "A", QString());
+
+	auto changes = graph.resolveChanged();
+	QCOMPARE(changes.count(), 1);
+	QVERIFY(graph.resolution(1) == (Resolution{-1, 1, RedirectGraph::NotRedirect}));
+
+	// Pages that were never registered
+	QVERIFY(graph.resolution(99) == (Resolution{-1, -1, RedirectGraph::NotRedirect}));
+}
+
+void
+TestRedirectGraph::chain()
+{
+	// A -> B -> C
+	RedirectGraph graph;
+	graph.setPage(1, "A", "B");
+	graph.setPage(2, "B", "C");
+	graph.setPage(3, "C", QString());
+	graph.resolveChanged();
+
+	QVERIFY(graph.resolution(1) == (Resolution{2, 3, RedirectGraph::DoubleRedirect}));
+	QVERIFY(graph.resolution(2) == (Resolution{3, 3, RedirectGraph::Resolved}));
+	QVERIFY(graph.resolution(3) == (Resolution{-1, 3, RedirectGraph::NotRedirect}));
+
+	// C turns into a redirect to D. A and B are re-resolved without being touched.
+	graph.setPage(4, "D", QString());
+	graph.setPage(3, "C", "D");
+	auto changes = graph.resolveChanged();
+	QVERIFY(changes.contains(1));
+	QVERIFY(changes.contains(2));
+	QVERIFY(graph.resolution(1) == (Resolution{2, 4, RedirectGraph::DoubleRedirect}));
+	QVERIFY(graph.resolution(2) == (Resolution{3, 4, RedirectGraph::DoubleRedirect}));
+	QVERIFY(graph.resolution(3) == (Resolution{4, 4, RedirectGraph::Resolved}));
+}
+
+void
+TestRedirectGraph::loop()
+{
+	// A -> B -> C -> A, and D leads into the loop
+	RedirectGraph graph;
+	graph.setPage(1, "A", "B");
+	graph.setPage(2, "B", "C");
+	graph.setPage(3, "C", "A");
+	graph.setPage(4, "D", "A");
+	graph.resolveChanged();
+
+	QVERIFY(graph.resolution(1) == (Resolution{2, -1, RedirectGraph::Loop}));
+	QVERIFY(graph.resolution(2) == (Resolution{3, -1, RedirectGraph::Loop}));
+	QVERIFY(graph.resolution(3) == (Resolution{1, -1, RedirectGraph::Loop}));
+	QVERIFY(graph.resolution(4) == (Resolution{1, -1, RedirectGraph::Loop}));
+
+	// A page that redirects to itself
+	graph.setPage(5, "E", "E");
+	graph.resolveChanged();
+	QVERIFY(graph.resolution(5) == (Resolution{5, -1, RedirectGraph::Loop}));
+
+	// Breaking the loop fixes everything that led into it
+	graph.setPage(3, "C", QString());
+	graph.resolveChanged();
+	QVERIFY(graph.resolution(1) == (Resolution{2, 3, RedirectGraph::DoubleRedirect}));
+	QVERIFY(graph.resolution(4) == (Resolution{1, 3, RedirectGraph::DoubleRedirect}));
+}
+
+void
+TestRedirectGraph::brokenUntilTargetAppears()
+{
+	RedirectGraph graph;
+	graph.setPage(1, "A", "Missing");
+	graph.setPage(2, "B", "A");
+	graph.resolveChanged();
+
+	QVERIFY(graph.resolution(1) == (Resolution{-1, -1, RedirectGraph::Broken}));
+	QVERIFY(graph.resolution(2) == (Resolution{1, -1, RedirectGraph::Broken}));
+
+	graph.setPage(3, "Missing", QString());
+	auto changes = graph.resolveChanged();
+	QCOMPARE(changes.count(), 3);
+	QVERIFY(graph.resolution(1) == (Resolution{3, 3, RedirectGraph::Resolved}));
+	QVERIFY(graph.resolution(2) == (Resolution{1, 3, RedirectGraph::DoubleRedirect}));
+}
+
+void
+TestRedirectGraph::removedTargetBreaksChain()
+{
+	RedirectGraph graph;
+	graph.setPage(1, "A", "B");
+	graph.setPage(2, "B", QString());
+	graph.resolveChanged();
+	QVERIFY(graph.resolution(1) == (Resolution{2, 2, RedirectGraph::Resolved}));
+
+	graph.removePage(2);
+	auto changes = graph.resolveChanged();
+	QVERIFY(!changes.contains(2));
+	QCOMPARE(graph.pageCount(), 1);
+	QVERIFY(graph.resolution(1) == (Resolution{-1, -1, RedirectGraph::Broken}));
+
+	// A renamed page is found under its new title only
+	graph.setPage(3, "C", QString());
+	graph.setPage(1, "A", "C");
+	graph.resolveChanged();
+	graph.setPage(3, "C2", QString());
+	graph.resolveChanged();
+	QVERIFY(graph.resolution(1) == (Resolution{-1, -1, RedirectGraph::Broken}));
+}
+
+void
+TestRedirectGraph::retargetReportsOnlyChanges()
+{
+	RedirectGraph graph;
+	graph.setPage(1, "A", "B");
+	graph.setPage(2, "B", QString());
+	graph.setPage(3, "C", QString());
+	graph.resolveChanged();
+
+	// Nothing changed
+	graph.setPage(1, "A", "B");
+	QVERIFY(graph.resolveChanged().isEmpty());
+
+	// Only A is looked at again
+	graph.setPage(1, "A", "C");
+	auto changes = graph.resolveChanged();
+	QCOMPARE(changes.keys(), QList<int>{1});
+	QVERIFY(changes[1] == (Resolution{3, 3, RedirectGraph::Resolved}));
+}
+
+void
+TestRedirectGraph::counts()
+{
+	RedirectGraph graph;
+	graph.setPage(1, "A", "B");
+	graph.setPage(2, "B", "C");
+	graph.setPage(3, "C", QString());
+	graph.setPage(4, "D", "Missing");
+	graph.setPage(5, "E", "E");
+	graph.resolveChanged();
+
+	QCOMPARE(graph.count(RedirectGraph::NotRedirect), 1);
+	QCOMPARE(graph.count(RedirectGraph::Resolved), 1);
+	QCOMPARE(graph.count(RedirectGraph::DoubleRedirect), 1);
+	QCOMPARE(graph.count(RedirectGraph::Broken), 1);
+	QCOMPARE(graph.count(RedirectGraph::Loop), 1);
+
+	for (auto status : {RedirectGraph::NotRedirect, RedirectGraph::Resolved, RedirectGraph::DoubleRedirect,
+			RedirectGraph::Broken, RedirectGraph::Loop})
+	{
+		QCOMPARE(RedirectGraph::statusFromName(RedirectGraph::statusName(status)), status);
+	}
+
+	graph.clear();
+	QCOMPARE(graph.pageCount(), 0);
+	QCOMPARE(graph.count(RedirectGraph::Resolved), 0);
+}
+
+QTEST_APPLESS_MAIN(TestRedirectGraph)
+#include "tst_redirectgraph.moc"
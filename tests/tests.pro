@@ -0,0 +1,9 @@
+# -------------------------------------------------
+# Unit tests for Wique. Run them with "make check".
+# -------------------------------------------------
+TEMPLATE = subdirs
+SUBDIRS += \
+    jsonstreamreader \
+    logsink \
+    redirectgraph \
+    wikilinks
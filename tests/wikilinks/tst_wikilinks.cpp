@@ -0,0 +1,182 @@
+// Copyright (c) 2015 Sze Howe Koh
+// This code is licensed under the MIT license (see LICENSE.MIT for details)
+
+#include "wikilinks.h"
+
+#include <QJsonDocument>
+#include <QtTest>
+
+// The parts of a German wiki's siteinfo that WikiLinks reads
+static const char* germanSiteInfo = R"({
+	"general": {"case": "first-letter"},
+	"namespaces": {
+		"0": {"id": 0, "case": "first-letter", "*": ""},
+		"6": {"id": 6, "case": "first-letter", "canonical": "File", "*": "Datei"},
+		"14": {"id": 14, "case": "first-letter", "canonical": "Category", "*": "Kategorie"}
+	},
+	"namespacealiases": [{"id": 6, "*": "Bild"}],
+	"magicwords": [{"name": "redirect", "aliases": ["#WEITERLEITUNG", "#REDIRECT"]}]
+})";
+
+// A wiki where "iPhone" and "IPhone" are different pages, and "#REDIRECT" must be in upper case
+static const char* caseSensitiveSiteInfo = R"({
+	"general": {"case": "case-sensitive"},
+	"namespaces": {
+		"0": {"id": 0, "case": "case-sensitive", "*": ""},
+		"2": {"id": 2, "case": "first-letter", "canonical": "User", "*": "User"}
+	},
+	"magicwords": [{"name": "redirect", "aliases": ["#REDIRECT"], "case-sensitive": ""}]
+})";
+
+static QJsonObject
+siteInfo(const char* json)
+{
+	return QJsonDocument::fromJson(json).object();
+}
+
+class TestWikiLinks : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void redirectTarget_data();
+	void redirectTarget();
+	void links_data();
+	void links();
+	void normalizeTitle_data();
+	void normalizeTitle();
+	void siteInfoNamespaces();
+	void siteInfoRedirects();
+	void siteInfoCase();
+};
+
+void
+TestWikiLinks::redirectTarget_data()
+{
+	QTest::addColumn<QString>("wikiText");
+	QTest::addColumn<QString>("target");
+
+	QTest::newRow("plain") << "#REDIRECT [[Foo]]" << "Foo";
+	QTest::newRow("no space") << "#REDIRECT[[Foo]]" << "Foo";
+	QTest::newRow("lower case, colon") << "#redirect:[[foo_bar]]" << "Foo bar";
+	QTest::newRow("leading whitespace") << "  \n#REDIRECT [[Foo]]" << "Foo";
+	QTest::newRow("section and label") << "#REDIRECT [[Foo#Usage|label]]" << "Foo";
+	QTest::newRow("extra spaces") << "#REDIRECT [[ foo   bar ]]" << "Foo bar";
+	QTest::newRow("namespace alias") << "#REDIRECT [[image:a.png]]" << "File:A.png";
+	QTest::newRow("category") << "#REDIRECT [[:Category:Foo]]" << "Category:Foo";
+	QTest::newRow("longer word first") << "#REDIRECTION [[Cible]]" << "Cible";
+	QTest::newRow("translated") << "#WEITERLEITUNG [[Ziel]]" << "Ziel";
+	QTest::newRow("text before") << "Text\n#REDIRECT [[Foo]]" << "";
+	QTest::newRow("no link") << "#REDIRECT Foo" << "";
+	QTest::newRow("unclosed link") << "#REDIRECT [[Foo" << "";
+	QTest::newRow("single bracket") << "#REDIRECT [Foo]" << "";
+	QTest::newRow("unknown word") << "#REDIRECTED [[Foo]]" << "";
+	QTest::newRow("empty") << "" << "";
+}
+
+void
+TestWikiLinks::redirectTarget()
+{
+	QFETCH(QString, wikiText);
+	QFETCH(QString, target);
+
+	QCOMPARE(WikiLinks().redirectTarget(wikiText), target);
+}
+
+void
+TestWikiLinks::links_data()
+{
+	QTest::addColumn<QString>("wikiText");
+	QTest::addColumn<QStringList>("links");
+
+	QTest::newRow("none") << "No links here" << QStringList();
+	QTest::newRow("duplicates") << "[[A]] and [[a]] and [[A|again]]" << QStringList{"A"};
+	QTest::newRow("label and section") << "[[B|label]] [[C#Usage]]" << QStringList{"B", "C"};
+	QTest::newRow("same page section") << "[[#Usage]]" << QStringList();
+	QTest::newRow("category tag") << "[[Category:C]] [[:Category:D]]" << QStringList{"Category:D"};
+	QTest::newRow("link in caption") << "[[File:X.png|thumb|A [[Page]] shot]]" << QStringList{"Page"};
+	QTest::newRow("extra bracket") << "[[[X]]]" << QStringList{"X"};
+	QTest::newRow("line break") << "[[A\nB]]" << QStringList();
+	QTest::newRow("template") << "{{Note|[[Link]]}} [[{{X}}]]" << QStringList{"Link"};
+	QTest::newRow("single brackets") << "[x] [http://example.com y] [[ foo_bar ]] [" << QStringList{"Foo bar"};
+	QTest::newRow("unclosed") << "[[A]] [[B" << QStringList{"A"};
+	QTest::newRow("single closing bracket") << "[[A] [[B]]" << QStringList{"B"};
+}
+
+void
+TestWikiLinks::links()
+{
+	QFETCH(QString, wikiText);
+	QFETCH(QStringList, links);
+
+	QCOMPARE(WikiLinks().links(wikiText), links);
+}
+
+void
+TestWikiLinks::normalizeTitle_data()
+{
+	QTest::addColumn<QString>("link");
+	QTest::addColumn<QString>("title");
+
+	QTest::newRow("underscores") << "_foo__bar_" << "Foo bar";
+	QTest::newRow("leading colon") << ":foo" << "Foo";
+	QTest::newRow("namespace") << "help talk : foo" << "Help talk:Foo";
+	QTest::newRow("unknown prefix") << "foo:bar" << "Foo:bar";
+	QTest::newRow("outside the BMP") << QString::fromUtf8("\xF0\x9D\x90\x80x") << QString::fromUtf8("\xF0\x9D\x90\x80x");
+	QTest::newRow("empty") << "" << "";
+}
+
+void
+TestWikiLinks::normalizeTitle()
+{
+	QFETCH(QString, link);
+	QFETCH(QString, title);
+
+	QCOMPARE(WikiLinks().normalizeTitle(link), title);
+}
+
+void
+TestWikiLinks::siteInfoNamespaces()
+{
+	auto wikiLinks = WikiLinks::fromSiteInfo(siteInfo(germanSiteInfo));
+
+	// Local names, canonical names and aliases all lead to the local name
+	QCOMPARE(wikiLinks.normalizeTitle(QString("datei:x.png")), QString("Datei:X.png"));
+	QCOMPARE(wikiLinks.normalizeTitle(QString("File:x.png")), QString("Datei:X.png"));
+	QCOMPARE(wikiLinks.normalizeTitle(QString("bild:x.png")), QString("Datei:X.png"));
+
+	// Category tags in either language
+	QCOMPARE(wikiLinks.links("[[Kategorie:K]] [[category:K2]] [[:Kategorie:K3]] [[A]]"),
+			(QStringList{"Kategorie:K3", "A"}));
+}
+
+void
+TestWikiLinks::siteInfoRedirects()
+{
+	auto wikiLinks = WikiLinks::fromSiteInfo(siteInfo(germanSiteInfo));
+	QCOMPARE(wikiLinks.redirectTarget("#weiterleitung [[ziel]]"), QString("Ziel"));
+	QCOMPARE(wikiLinks.redirectTarget("#REDIRECT [[Ziel]]"), QString("Ziel"));
+	QCOMPARE(wikiLinks.redirectTarget("#BILD [[Ziel]]"), QString());
+
+	// Only the wiki's own words count once they are known
+	QCOMPARE(wikiLinks.redirectTarget("#RINVIA [[Ziel]]"), QString());
+	QCOMPARE(WikiLinks().redirectTarget("#RINVIA [[Ziel]]"), QString("Ziel"));
+
+	// Nothing known: the defaults
+	QCOMPARE(WikiLinks::fromSiteInfo(QJsonObject()).redirectTarget("#RINVIA [[x]]"), QString("X"));
+}
+
+void
+TestWikiLinks::siteInfoCase()
+{
+	auto wikiLinks = WikiLinks::fromSiteInfo(siteInfo(caseSensitiveSiteInfo));
+	QCOMPARE(wikiLinks.normalizeTitle(QString("iPhone")), QString("iPhone"));
+	QCOMPARE(wikiLinks.normalizeTitle(QString("user:bob")), QString("User:Bob"));
+	QCOMPARE(wikiLinks.links("[[iPhone]] [[IPhone]]"), (QStringList{"iPhone", "IPhone"}));
+
+	QCOMPARE(wikiLinks.redirectTarget("#REDIRECT [[iPhone]]"), QString("iPhone"));
+	QCOMPARE(wikiLinks.redirectTarget("#redirect [[iPhone]]"), QString());
+}
+
+QTEST_APPLESS_MAIN(TestWikiLinks)
+#include "tst_wikilinks.moc"
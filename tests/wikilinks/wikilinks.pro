@@ -0,0 +1,17 @@
+# -------------------------------------------------
+# Unit tests of WikiLinks
+# -------------------------------------------------
+QT += testlib
+QT -= gui
+CONFIG += C++11 console testcase
+CONFIG -= app_bundle
+TARGET = tst_wikilinks
+TEMPLATE = app
+
+WIQUE_SRC = ../../src
+INCLUDEPATH += $$WIQUE_SRC
+
+SOURCES += tst_wikilinks.cpp \
+    $$WIQUE_SRC/wikilinks.cpp
+HEADERS += \
+    $$WIQUE_SRC/wikilinks.h